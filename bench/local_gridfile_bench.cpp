@@ -0,0 +1,156 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmarks for LocalGridFile, the buffer every write goes
+// through. Prints one JSON document on stdout.
+
+#include "local_gridfile.h"
+#include "utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Bytes each case moves
+static const size_t TOTAL = 64 * 1024 * 1024;
+
+struct Result {
+  string name;
+  int chunkSize;
+  size_t ioSize;
+  size_t bytes;
+  double seconds;
+};
+
+static vector<Result> results;
+
+static void report(const string& name, int chunkSize, size_t ioSize,
+                   size_t bytes, double start)
+{
+  Result r;
+  r.name = name;
+  r.chunkSize = chunkSize;
+  r.ioSize = ioSize;
+  r.bytes = bytes;
+  r.seconds = monotonic_time() - start;
+  results.push_back(r);
+}
+
+static void sequential_write(int chunkSize, size_t ioSize, bool unaligned)
+{
+  // Off by one from the chunk size, every write straddles a boundary
+  // sooner or later
+  if(unaligned) {
+    ioSize++;
+  }
+
+  vector<char> buf(ioSize, 'x');
+  LocalGridFile lgf(chunkSize);
+
+  double start = monotonic_time();
+  size_t done = 0;
+  while(done + ioSize <= TOTAL) {
+    lgf.write(&buf[0], ioSize, done);
+    done += ioSize;
+  }
+  report(unaligned ? "unaligned_write" : "sequential_write",
+         chunkSize, ioSize, done, start);
+}
+
+static void random_write(int chunkSize, size_t ioSize)
+{
+  vector<char> buf(ioSize, 'x');
+  LocalGridFile lgf(chunkSize);
+  size_t slots = TOTAL / ioSize;
+
+  srand(42);
+  double start = monotonic_time();
+  for(size_t i = 0; i < slots; i++) {
+    lgf.write(&buf[0], ioSize, (off_t)(rand() % slots) * ioSize);
+  }
+  report("random_write", chunkSize, ioSize, slots * ioSize, start);
+}
+
+static void reads(int chunkSize, size_t ioSize)
+{
+  vector<char> buf(ioSize, 'x');
+  LocalGridFile lgf(chunkSize);
+  for(size_t done = 0; done < TOTAL; done += ioSize) {
+    lgf.write(&buf[0], ioSize, done);
+  }
+
+  double start = monotonic_time();
+  for(size_t done = 0; done < TOTAL; done += ioSize) {
+    lgf.read(&buf[0], ioSize, done);
+  }
+  report("sequential_read", chunkSize, ioSize, TOTAL, start);
+
+  size_t slots = TOTAL / ioSize;
+  srand(42);
+  start = monotonic_time();
+  for(size_t i = 0; i < slots; i++) {
+    lgf.read(&buf[0], ioSize, (off_t)(rand() % slots) * ioSize);
+  }
+  report("random_read", chunkSize, ioSize, slots * ioSize, start);
+}
+
+static void md5(int chunkSize)
+{
+  vector<char> buf(chunkSize, 'x');
+  LocalGridFile lgf(chunkSize);
+  for(size_t done = 0; done < TOTAL; done += chunkSize) {
+    lgf.write(&buf[0], chunkSize, done);
+  }
+
+  // Rewrites the first byte so the whole file has to be hashed again
+  double start = monotonic_time();
+  lgf.write(&buf[0], 1, 0);
+  lgf.md5();
+  report("md5_rehash", chunkSize, chunkSize, TOTAL, start);
+}
+
+int main(int argc, char* argv[])
+{
+  int chunk_sizes[] = {64 * 1024, 256 * 1024, 1024 * 1024};
+  size_t io_sizes[] = {4 * 1024, 64 * 1024, 1024 * 1024};
+
+  for(int c = 0; c < 3; c++) {
+    for(int i = 0; i < 3; i++) {
+      sequential_write(chunk_sizes[c], io_sizes[i], false);
+      sequential_write(chunk_sizes[c], io_sizes[i], true);
+      random_write(chunk_sizes[c], io_sizes[i]);
+      reads(chunk_sizes[c], io_sizes[i]);
+    }
+    md5(chunk_sizes[c]);
+  }
+
+  printf("{\"benchmark\": \"local_gridfile\", \"results\": [\n");
+  for(size_t i = 0; i < results.size(); i++) {
+    const Result& r = results[i];
+    printf("  {\"name\": \"%s\", \"chunk_size\": %d, \"io_size\": %lu, "
+           "\"bytes\": %lu, \"seconds\": %.6f, \"mb_per_sec\": %.2f}%s\n",
+           r.name.c_str(), r.chunkSize, (unsigned long)r.ioSize,
+           (unsigned long)r.bytes, r.seconds,
+           r.seconds > 0 ? r.bytes / r.seconds / (1024 * 1024) : 0.0,
+           i + 1 < results.size() ? "," : "");
+  }
+  printf("]}\n");
+
+  return 0;
+}
@@ -0,0 +1,136 @@
+#!/usr/bin/env python
+"""End to end benchmarks against a real mount.
+
+Mounts ./mount_gridfs on a temporary directory, runs each benchmark and
+prints the results as one JSON document on stdout. Extra arguments are
+passed to mount_gridfs, e.g. --backend=memory --latency=1 to measure
+without a mongod.
+"""
+from __future__ import with_statement
+import json
+import optparse
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+def mount(args):
+    mount_point = tempfile.mkdtemp(prefix='gridfs-bench-')
+    subprocess.check_call(['./mount_gridfs'] + args + [mount_point])
+
+    # wait for mount to complete
+    time.sleep(1)
+    return mount_point
+
+def unmount(mount_point):
+    if sys.platform.startswith('linux'):
+        subprocess.check_call(['fusermount', '-u', mount_point])
+    else:
+        subprocess.check_call(['umount', mount_point])
+    os.rmdir(mount_point)
+
+def timed(f, *args):
+    start = time.time()
+    result = f(*args)
+    return time.time() - start, result
+
+def write_file(path, size, block):
+    data = b'x' * block
+    with open(path, 'wb') as f:
+        for i in range(size // block):
+            f.write(data)
+
+def sequential_read(path, block):
+    total = 0
+    with open(path, 'rb') as f:
+        while True:
+            data = f.read(block)
+            if not data:
+                return total
+            total += len(data)
+
+def random_read(path, size, block, count):
+    rng = random.Random(42)
+    with open(path, 'rb') as f:
+        for i in range(count):
+            f.seek(rng.randrange(size // block) * block)
+            f.read(block)
+    return count * block
+
+def create_files(directory, count, size):
+    os.mkdir(directory)
+    data = b'x' * size
+    for i in range(count):
+        with open(os.path.join(directory, 'file%06d' % i), 'wb') as f:
+            f.write(data)
+
+def stat_files(directory, count):
+    for i in range(count):
+        os.stat(os.path.join(directory, 'file%06d' % i))
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] [mount_gridfs args]')
+    parser.add_option('--db', default='gridfsbench')
+    parser.add_option('--size', type='int', default=64,
+                      help='MB in the large file (default 64)')
+    parser.add_option('--files', type='int', default=2000,
+                      help='small files to create (default 2000)')
+    parser.add_option('--block', type='int', default=128 * 1024,
+                      help='bytes per read and write call (default 128k)')
+    options, args = parser.parse_args()
+
+    size = options.size * 1024 * 1024
+    results = []
+
+    def record(name, seconds, **fields):
+        fields.update(name=name, seconds=round(seconds, 6))
+        results.append(fields)
+
+    mount_point = mount(['--db=' + options.db] + args)
+    try:
+        big = os.path.join(mount_point, 'bench.bin')
+        seconds, _ = timed(write_file, big, size, options.block)
+        record('sequential_write', seconds, bytes=size,
+               mb_per_sec=round(size / seconds / 2**20, 2))
+
+        seconds, total = timed(sequential_read, big, options.block)
+        record('sequential_read', seconds, bytes=total,
+               mb_per_sec=round(total / seconds / 2**20, 2))
+
+        count = 1000
+        seconds, total = timed(random_read, big, size, 4096, count)
+        record('random_read', seconds, bytes=total, reads=count,
+               reads_per_sec=round(count / seconds, 2))
+
+        many = os.path.join(mount_point, 'many')
+        seconds, _ = timed(create_files, many, options.files, 1024)
+        record('small_file_create', seconds, files=options.files,
+               files_per_sec=round(options.files / seconds, 2))
+
+        seconds, _ = timed(stat_files, many, options.files)
+        record('stat', seconds, files=options.files,
+               stats_per_sec=round(options.files / seconds, 2))
+
+        runs = []
+        for i in range(5):
+            seconds, names = timed(os.listdir, many)
+            runs.append(seconds)
+        runs.sort()
+        record('readdir', runs[len(runs) // 2], entries=len(names),
+               runs=len(runs))
+
+        for name in names:
+            os.remove(os.path.join(many, name))
+        os.rmdir(many)
+        os.remove(big)
+    finally:
+        unmount(mount_point)
+
+    json.dump({'benchmark': 'mount', 'args': args, 'results': results},
+              sys.stdout, indent=2)
+    sys.stdout.write('\n')
+
+if __name__ == '__main__':
+    main()
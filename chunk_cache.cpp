@@ -0,0 +1,154 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunk_cache.h"
+
+#include <boost/functional/hash.hpp>
+
+using namespace std;
+
+ChunkCache chunk_cache;
+
+ChunkCache::ChunkCache(size_t capacity)
+{
+  setCapacity(capacity);
+}
+
+void ChunkCache::setCapacity(size_t capacity)
+{
+  _capacity = capacity;
+  _shardCapacity = capacity / NUM_SHARDS;
+
+  for(int i = 0; i < NUM_SHARDS; i++) {
+    boost::mutex::scoped_lock lock(_shards[i].mutex);
+    evict(_shards[i]);
+  }
+}
+
+ChunkCache::Shard& ChunkCache::shardFor(const Key& key)
+{
+  size_t seed = 0;
+  boost::hash_combine(seed, key.first);
+  boost::hash_combine(seed, key.second);
+  return _shards[seed % NUM_SHARDS];
+}
+
+ChunkCache::Chunk ChunkCache::get(const string& files_id, int n)
+{
+  Key key(files_id, n);
+  Shard& shard = shardFor(key);
+  boost::mutex::scoped_lock lock(shard.mutex);
+
+  map<Key, LRUList::iterator>::iterator i = shard.index.find(key);
+  if(i == shard.index.end()) {
+    shard.misses++;
+    return Chunk();
+  }
+
+  shard.hits++;
+  shard.lru.splice(shard.lru.begin(), shard.lru, i->second);
+  return i->second->chunk;
+}
+
+void ChunkCache::put(const string& files_id, int n, const Chunk& chunk)
+{
+  if(!chunk || chunk->size() > _shardCapacity) {
+    return;
+  }
+
+  Key key(files_id, n);
+  Shard& shard = shardFor(key);
+  boost::mutex::scoped_lock lock(shard.mutex);
+
+  map<Key, LRUList::iterator>::iterator i = shard.index.find(key);
+  if(i != shard.index.end()) {
+    shard.bytes -= i->second->chunk->size();
+    shard.lru.erase(i->second);
+    shard.index.erase(i);
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.chunk = chunk;
+  shard.lru.push_front(entry);
+  shard.index[key] = shard.lru.begin();
+  shard.bytes += chunk->size();
+
+  evict(shard);
+}
+
+bool ChunkCache::contains(const string& files_id, int n)
+{
+  Key key(files_id, n);
+  Shard& shard = shardFor(key);
+  boost::mutex::scoped_lock lock(shard.mutex);
+  return shard.index.find(key) != shard.index.end();
+}
+
+void ChunkCache::erase(const string& files_id, int n)
+{
+  Key key(files_id, n);
+  Shard& shard = shardFor(key);
+  boost::mutex::scoped_lock lock(shard.mutex);
+
+  map<Key, LRUList::iterator>::iterator i = shard.index.find(key);
+  if(i != shard.index.end()) {
+    shard.bytes -= i->second->chunk->size();
+    shard.lru.erase(i->second);
+    shard.index.erase(i);
+  }
+}
+
+void ChunkCache::evict(Shard& shard)
+{
+  while(shard.bytes > _shardCapacity && !shard.lru.empty()) {
+    Entry& victim = shard.lru.back();
+    shard.bytes -= victim.chunk->size();
+    shard.index.erase(victim.key);
+    shard.lru.pop_back();
+  }
+}
+
+unsigned long long ChunkCache::hits()
+{
+  unsigned long long total = 0;
+  for(int i = 0; i < NUM_SHARDS; i++) {
+    boost::mutex::scoped_lock lock(_shards[i].mutex);
+    total += _shards[i].hits;
+  }
+  return total;
+}
+
+unsigned long long ChunkCache::misses()
+{
+  unsigned long long total = 0;
+  for(int i = 0; i < NUM_SHARDS; i++) {
+    boost::mutex::scoped_lock lock(_shards[i].mutex);
+    total += _shards[i].misses;
+  }
+  return total;
+}
+
+size_t ChunkCache::size()
+{
+  size_t total = 0;
+  for(int i = 0; i < NUM_SHARDS; i++) {
+    boost::mutex::scoped_lock lock(_shards[i].mutex);
+    total += _shards[i].bytes;
+  }
+  return total;
+}
@@ -0,0 +1,84 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHUNK_CACHE_H
+#define __CHUNK_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+// Process wide LRU cache of fs.chunks data keyed by (files_id, n).
+// Entries are spread over independently locked shards so concurrent
+// FUSE threads rarely contend, and each shard evicts against its share
+// of the byte budget.
+class ChunkCache {
+public:
+  typedef boost::shared_ptr<const std::string> Chunk;
+  typedef std::pair<std::string, int> Key;
+
+  ChunkCache(size_t capacity = 0);
+
+  void setCapacity(size_t capacity);
+  size_t getCapacity() const { return _capacity; }
+
+  // Returns an empty pointer on a miss
+  Chunk get(const std::string& files_id, int n);
+  void put(const std::string& files_id, int n, const Chunk& chunk);
+  bool contains(const std::string& files_id, int n);
+  // Drops a chunk that was rewritten in place
+  void erase(const std::string& files_id, int n);
+
+  unsigned long long hits();
+  unsigned long long misses();
+  size_t size();
+
+private:
+  static const int NUM_SHARDS = 16;
+
+  struct Entry {
+    Key key;
+    Chunk chunk;
+  };
+
+  typedef std::list<Entry> LRUList;
+
+  struct Shard {
+    Shard() : bytes(0), hits(0), misses(0) {}
+
+    boost::mutex mutex;
+    LRUList lru;
+    std::map<Key, LRUList::iterator> index;
+    size_t bytes;
+    unsigned long long hits, misses;
+  };
+
+  Shard& shardFor(const Key& key);
+  void evict(Shard& shard);
+
+  size_t _capacity;
+  size_t _shardCapacity;
+  Shard _shards[NUM_SHARDS];
+};
+
+extern ChunkCache chunk_cache;
+
+#endif
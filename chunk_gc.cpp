@@ -0,0 +1,110 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunk_gc.h"
+#include "open_file_table.h"
+#include "storage.h"
+#include <iostream>
+#include <vector>
+
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace mongo;
+
+ChunkCollector chunk_gc;
+
+void ChunkCollector::start()
+{
+  _queue.start(1);
+}
+
+void ChunkCollector::stop()
+{
+  sweep();
+  _queue.stop();
+}
+
+void ChunkCollector::collect(const BSONObj& file)
+{
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    BSONObj id = BSON("_id" << file["_id"]);
+    _pending[id.firstElement().toString(false)] = id;
+  }
+  sweep();
+}
+
+void ChunkCollector::sweep()
+{
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    if(_pending.empty() || _scheduled) {
+      return;
+    }
+    _scheduled = true;
+  }
+
+  if(!_queue.push(boost::bind(&ChunkCollector::run, this))) {
+    run();
+  }
+}
+
+void ChunkCollector::run()
+{
+  vector<pair<string, BSONObj> > ready;
+
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _scheduled = false;
+
+    map<string, BSONObj>::iterator i = _pending.begin();
+    while(i != _pending.end()) {
+      if(open_files.usesFile(i->first)) {
+        i++;
+        continue;
+      }
+      ready.push_back(*i);
+      _pending.erase(i++);
+    }
+  }
+
+  if(ready.empty()) {
+    return;
+  }
+
+  // A removal the server didn't acknowledge is tried again on the next
+  // sweep
+  vector<pair<string, BSONObj> > failed;
+  try {
+    for(vector<pair<string, BSONObj> >::iterator i = ready.begin();
+        i != ready.end(); i++) {
+      if(!storage->removeChunks(i->second)) {
+        failed.push_back(*i);
+      }
+    }
+  } catch(DBException& e) {
+    // Leaves orphaned chunks behind but nothing can read them
+    cerr << "gridfs-fuse: removing replaced chunks failed: "
+         << e.what() << endl;
+  }
+
+  if(!failed.empty()) {
+    boost::mutex::scoped_lock lock(_mutex);
+    _pending.insert(failed.begin(), failed.end());
+  }
+}
@@ -0,0 +1,61 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHUNK_GC_H
+#define __CHUNK_GC_H
+
+#include "work_queue.h"
+#include <map>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+#include <mongo/client/dbclient.h>
+
+// Removes the fs.chunks of versions that were replaced or unlinked.
+// Their fs.files documents are gone already, but handles opened before
+// that keep reading the chunks by _id, so each version is only
+// collected once no open handle refers to it. Removal happens on a
+// background thread so flush and unlink never wait for it.
+class ChunkCollector {
+public:
+  ChunkCollector() : _scheduled(false) {}
+
+  void start();
+  // Sweeps whatever is left, then joins the thread
+  void stop();
+
+  // Queues the chunks of the fs.files document file for removal
+  void collect(const mongo::BSONObj& file);
+
+  // Removes the queued versions nothing has open any more. Cheap when
+  // there's nothing queued, so it's run whenever a handle is released.
+  void sweep();
+
+private:
+  void run();
+
+  boost::mutex _mutex;
+  // Chunk cache key to the version's _id, as { _id: ... }
+  std::map<std::string, mongo::BSONObj> _pending;
+  bool _scheduled;
+  WorkQueue _queue;
+};
+
+extern ChunkCollector chunk_gc;
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunk_pool.h"
+#include <cstring>
+
+using namespace std;
+
+ChunkPool chunk_pool;
+
+ChunkPool::~ChunkPool()
+{
+  setMaxCached(0);
+}
+
+void ChunkPool::setMaxCached(size_t maxCached)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _maxCached = maxCached;
+  trim();
+}
+
+char* ChunkPool::allocate(size_t size, bool zero)
+{
+  char* buf = NULL;
+
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _outstanding += size;
+
+    map<size_t, vector<char*> >::iterator i = _free.find(size);
+    if(i != _free.end() && !i->second.empty()) {
+      buf = i->second.back();
+      i->second.pop_back();
+      _cached -= size;
+      _hits++;
+    } else {
+      _misses++;
+    }
+  }
+
+  if(!buf) {
+    buf = new char[size];
+  }
+
+  if(zero) {
+    memset(buf, 0, size);
+  }
+
+  return buf;
+}
+
+void ChunkPool::deallocate(char* buf, size_t size)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _outstanding -= size;
+
+  if(_cached + size > _maxCached) {
+    delete[] buf;
+    return;
+  }
+
+  _free[size].push_back(buf);
+  _cached += size;
+}
+
+// Frees cached buffers until we're back under the limit
+void ChunkPool::trim()
+{
+  map<size_t, vector<char*> >::iterator i = _free.begin();
+  while(_cached > _maxCached && i != _free.end()) {
+    while(_cached > _maxCached && !i->second.empty()) {
+      delete[] i->second.back();
+      i->second.pop_back();
+      _cached -= i->first;
+    }
+    i++;
+  }
+}
+
+size_t ChunkPool::cachedBytes()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _cached;
+}
+
+size_t ChunkPool::outstandingBytes()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _outstanding;
+}
+
+unsigned long long ChunkPool::hits()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _hits;
+}
+
+unsigned long long ChunkPool::misses()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _misses;
+}
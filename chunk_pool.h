@@ -0,0 +1,59 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHUNK_POOL_H
+#define __CHUNK_POOL_H
+
+#include <map>
+#include <vector>
+#include <cstddef>
+
+#include <boost/thread/mutex.hpp>
+
+// Recycles chunk buffers between files instead of handing them back to
+// malloc. Freed buffers are kept on a free list per size, up to a total
+// of maxCached bytes across all sizes.
+class ChunkPool {
+public:
+  ChunkPool(size_t maxCached = 0) :
+    _maxCached(maxCached), _cached(0), _outstanding(0), _hits(0),
+    _misses(0) {}
+  ~ChunkPool();
+
+  void setMaxCached(size_t maxCached);
+
+  // Skip zeroing when the caller is about to overwrite the whole buffer
+  char* allocate(size_t size, bool zero = true);
+  void deallocate(char* buf, size_t size);
+
+  size_t cachedBytes();
+  size_t outstandingBytes();
+  unsigned long long hits();
+  unsigned long long misses();
+
+private:
+  void trim();
+
+  boost::mutex _mutex;
+  std::map<size_t, std::vector<char*> > _free;
+  size_t _maxCached, _cached, _outstanding;
+  unsigned long long _hits, _misses;
+};
+
+extern ChunkPool chunk_pool;
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "connection_pool.h"
+#include "metrics.h"
+#include "utils.h"
+#include <unistd.h>
+
+using namespace std;
+using namespace mongo;
+
+ConnectionPool connections;
+
+void ConnectionPool::configure(const string& host, unsigned maxIdle,
+                               unsigned healthCheck, unsigned retries,
+                               unsigned retryDelayMs)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _host = host;
+  _maxIdle = maxIdle;
+  _healthCheck = healthCheck;
+  _retries = retries;
+  _retryDelay = retryDelayMs;
+}
+
+DBClientConnection* ConnectionPool::get()
+{
+  for(;;) {
+    Idle idle;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      if(_idle.empty()) {
+        break;
+      }
+      idle = _idle.back();
+      _idle.pop_back();
+    }
+
+    if(!_healthCheck || monotonic_time() - idle.since < _healthCheck ||
+       healthy(idle.conn)) {
+      return idle.conn;
+    }
+
+    delete idle.conn;
+  }
+
+  return connect();
+}
+
+void ConnectionPool::release(DBClientConnection* conn)
+{
+  if(!conn->isFailed()) {
+    boost::mutex::scoped_lock lock(_mutex);
+    if(_idle.size() < _maxIdle) {
+      Idle idle = { conn, monotonic_time() };
+      _idle.push_back(idle);
+      return;
+    }
+  }
+
+  delete conn;
+}
+
+void ConnectionPool::flush()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  for(vector<Idle>::iterator i = _idle.begin(); i != _idle.end(); i++) {
+    delete i->conn;
+  }
+  _idle.clear();
+}
+
+DBClientConnection* ConnectionPool::connect()
+{
+  string errmsg;
+  unsigned delay = _retryDelay;
+
+  for(unsigned attempt = 0; attempt <= _retries; attempt++) {
+    if(attempt) {
+      usleep(delay * 1000);
+      delay *= 2;
+    }
+
+    // Also reconnects on its own if the socket drops between operations
+    DBClientConnection* conn = new DBClientConnection(true);
+    metrics.add(Metrics::CONNECTS);
+    if(conn->connect(_host, errmsg)) {
+      return conn;
+    }
+    delete conn;
+  }
+
+  throw ConnectException("can't connect to " + _host + ": " + errmsg);
+}
+
+bool ConnectionPool::healthy(DBClientConnection* conn)
+{
+  BSONObj info;
+  try {
+    metrics.add(Metrics::ROUND_TRIPS);
+    return conn->runCommand("admin", BSON("ping" << 1), info);
+  } catch(DBException& e) {
+    return false;
+  }
+}
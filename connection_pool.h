@@ -0,0 +1,93 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __CONNECTION_POOL_H
+#define __CONNECTION_POOL_H
+
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+#include <mongo/client/dbclient.h>
+
+// Connections to mongod kept open between operations. The most recently
+// returned connection is handed out first, so a busy thread tends to get
+// the same warm socket back. One that has been idle for longer than the
+// health check interval is pinged before it's reused, and new
+// connections are retried with a doubling delay when mongod can't be
+// reached.
+class ConnectionPool {
+public:
+  ConnectionPool() :
+    _maxIdle(8), _healthCheck(60), _retries(3), _retryDelay(100) {}
+  ~ConnectionPool() { flush(); }
+
+  // maxIdle caps the connections kept open while unused, not how many
+  // can be in use at once. A healthCheck of 0 never pings.
+  void configure(const std::string& host, unsigned maxIdle,
+                 unsigned healthCheck, unsigned retries,
+                 unsigned retryDelayMs);
+
+  // Throws a ConnectException once every attempt has failed
+  mongo::DBClientConnection* get();
+  void release(mongo::DBClientConnection* conn);
+  // Closes every idle connection
+  void flush();
+
+private:
+  struct Idle {
+    mongo::DBClientConnection* conn;
+    double since;
+  };
+
+  mongo::DBClientConnection* connect();
+  bool healthy(mongo::DBClientConnection* conn);
+
+  std::string _host;
+  unsigned _maxIdle, _healthCheck, _retries, _retryDelay;
+  boost::mutex _mutex;
+  std::vector<Idle> _idle;
+};
+
+extern ConnectionPool connections;
+
+// A connection checked out of the pool for one operation. Like
+// ScopedDbConnection, it only goes back to the pool if done() is called;
+// one abandoned by an exception may be mid-reply and is closed.
+class Connection {
+public:
+  Connection() : _conn(connections.get()) {}
+  ~Connection() { delete _conn; }
+
+  mongo::DBClientBase& conn() { return *_conn; }
+  mongo::DBClientBase* operator->() { return _conn; }
+
+  void done() {
+    connections.release(_conn);
+    _conn = NULL;
+  }
+
+private:
+  Connection(const Connection&);
+  Connection& operator=(const Connection&);
+
+  mongo::DBClientConnection* _conn;
+};
+
+#endif
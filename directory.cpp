@@ -0,0 +1,201 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "directory.h"
+#include "storage.h"
+#include "utils.h"
+#include <cstring>
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/mutex.hpp>
+
+using namespace std;
+using namespace mongo;
+
+static string child_prefix(const string& path)
+{
+  return path.empty() ? path : path + "/";
+}
+
+// Smallest string greater than every name starting with prefix + "/"
+static string past_children(const string& prefix)
+{
+  return prefix + "0";
+}
+
+// Stops a listing at its first file
+static bool found(bool* any)
+{
+  *any = true;
+  return false;
+}
+
+static boost::mutex made_mutex;
+static set<string> made;
+
+void make_directory(const string& path)
+{
+  boost::mutex::scoped_lock lock(made_mutex);
+  made.insert(path);
+}
+
+bool remove_made_directory(const string& path)
+{
+  boost::mutex::scoped_lock lock(made_mutex);
+  return made.erase(path) > 0;
+}
+
+vector<string> made_directories(const string& path)
+{
+  string prefix = child_prefix(path);
+  vector<string> names;
+
+  boost::mutex::scoped_lock lock(made_mutex);
+  for(set<string>::iterator i = made.lower_bound(prefix);
+      i != made.end() && i->compare(0, prefix.size(), prefix) == 0; i++) {
+    string name = i->substr(prefix.size());
+    if(name.find('/') == string::npos) {
+      names.push_back(name);
+    }
+  }
+  return names;
+}
+
+bool directory_exists(const string& path)
+{
+  if(path.empty()) {
+    return true;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(made_mutex);
+    if(made.count(path)) {
+      return true;
+    }
+  }
+
+  BSONObj fields = BSON("_id" << 1);
+  bool any = false;
+  storage->listFiles(child_prefix(path), past_children(path), &fields,
+                     boost::bind(found, &any), 1);
+
+  return any;
+}
+
+namespace {
+  // Walks one run of the listing in filename order. Stops at the first
+  // subdirectory so the scan can restart past everything beneath it.
+  class Lister {
+  public:
+    Lister(const string& prefix, const DirEntrySink& sink) :
+      _prefix(prefix), _sink(sink), _listed(0), _stopped(false) {
+      directory_stat(&_dirSt);
+    }
+
+    bool operator()(const BSONObj& f) {
+      string name = string(f.getStringField("filename")).substr(_prefix.size());
+
+      size_t slash = name.find('/');
+      if(slash == string::npos) {
+        if(name.empty()) {
+          return true;
+        }
+
+        struct stat st;
+        file_stat(f, &st);
+        _listed++;
+        _stopped = !_sink(name, st);
+        return !_stopped;
+      }
+
+      if(slash == 0) {
+        return true;
+      }
+
+      // Report the subdirectory once and restart the scan after
+      // everything beneath it
+      string child = name.substr(0, slash);
+      _listed++;
+      _stopped = !_sink(child, _dirSt);
+      _restart = past_children(_prefix + child);
+      return false;
+    }
+
+    int listed() const { return _listed; }
+
+    // Where the next run starts, or "" if the listing is done
+    string next() {
+      string restart = _stopped ? "" : _restart;
+      _restart.clear();
+      return restart;
+    }
+
+  private:
+    const string& _prefix;
+    const DirEntrySink& _sink;
+    struct stat _dirSt;
+    int _listed;
+    bool _stopped;
+    string _restart;
+  };
+}
+
+int list_directory(const string& path, const DirEntrySink& sink)
+{
+  string prefix = child_prefix(path);
+  string upper = path.empty() ? "" : past_children(path);
+  BSONObj fields = stat_fields();
+
+  Lister lister(prefix, sink);
+  string lower = prefix;
+  do {
+    storage->listFiles(lower, upper, &fields, boost::ref(lister));
+    lower = lister.next();
+  } while(!lower.empty());
+
+  return lister.listed();
+}
+
+BSONObj stat_fields(bool metadata)
+{
+  if(metadata) {
+    return BSON("filename" << 1 << "length" << 1 << "uploadDate" << 1
+                << "metadata" << 1);
+  }
+  return BSON("filename" << 1 << "length" << 1 << "uploadDate" << 1);
+}
+
+void file_stat(const BSONObj& file, struct stat* st)
+{
+  memset(st, 0, sizeof(struct stat));
+  st->st_mode = S_IFREG | 0555;
+  st->st_nlink = 1;
+  st->st_size = file["length"].numberLong();
+
+  time_t upload_time = mongo_time_to_unix_time(file["uploadDate"].date());
+  st->st_ctime = upload_time;
+  st->st_mtime = upload_time;
+}
+
+void directory_stat(struct stat* st)
+{
+  memset(st, 0, sizeof(struct stat));
+  st->st_mode = S_IFDIR | 0777;
+  st->st_nlink = 2;
+}
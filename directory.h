@@ -0,0 +1,60 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DIRECTORY_H
+#define __DIRECTORY_H
+
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include <boost/function.hpp>
+
+#include <mongo/client/dbclient.h>
+
+// Directories are implied by '/' separated filenames. "a/b" is a
+// directory if any filename starts with "a/b/"; since '0' sorts right
+// after '/', every such name falls in the index range ["a/b/", "a/b0").
+
+// Called with each immediate child's name and attributes. Return false
+// to stop the listing.
+typedef boost::function<bool (const std::string&, const struct stat&)>
+  DirEntrySink;
+
+bool directory_exists(const std::string& path);
+
+// Directories made with mkdir, which have no filenames to imply them
+// yet. Nothing stores them, so one only lasts as long as the mount.
+void make_directory(const std::string& path);
+// False if path wasn't made with mkdir
+bool remove_made_directory(const std::string& path);
+// Names of the made directories immediately under path
+std::vector<std::string> made_directories(const std::string& path);
+
+// Lists the immediate children of path ("" for the root). Files come off
+// a single indexed cursor; each subdirectory costs one extra query to
+// skip past its contents. Returns the number of entries listed.
+int list_directory(const std::string& path, const DirEntrySink& sink);
+
+void file_stat(const mongo::BSONObj& file, struct stat* st);
+void directory_stat(struct stat* st);
+
+// Projection with just the fields file_stat needs, plus the xattrs if
+// metadata is set
+mongo::BSONObj stat_fields(bool metadata = false);
+
+#endif
@@ -0,0 +1,489 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "disk_cache.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <boost/bind.hpp>
+#include <boost/crc.hpp>
+
+using namespace std;
+
+DiskCache disk_cache;
+
+namespace {
+  const char INDEX_MAGIC[4] = { 'G', 'F', 'D', 'C' };
+  const unsigned INDEX_FORMAT = 1;
+
+  unsigned crc(const char* data, size_t len)
+  {
+    boost::crc_32_type result;
+    result.process_bytes(data, len);
+    return result.checksum();
+  }
+
+  void append_int(string& out, unsigned n)
+  {
+    char bytes[4] = { (char)n, (char)(n >> 8), (char)(n >> 16), (char)(n >> 24) };
+    out.append(bytes, 4);
+  }
+
+  void append_string(string& out, const string& s)
+  {
+    char len[2] = { (char)s.size(), (char)(s.size() >> 8) };
+    out.append(len, 2);
+    out.append(s);
+  }
+
+  // Reads fields back out of the index, stopping at the first one that
+  // runs past the end
+  class IndexReader {
+  public:
+    IndexReader(const string& data) : _data(data), _pos(0), _ok(true) {}
+
+    bool ok() const { return _ok; }
+    bool done() const { return _pos >= _data.size(); }
+
+    unsigned readInt() {
+      if(!_ok || _pos + 4 > _data.size()) {
+        _ok = false;
+        return 0;
+      }
+      const unsigned char* p = (const unsigned char*)_data.data() + _pos;
+      _pos += 4;
+      return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+    }
+
+    string readString() {
+      if(!_ok || _pos + 2 > _data.size()) {
+        _ok = false;
+        return string();
+      }
+      const unsigned char* p = (const unsigned char*)_data.data() + _pos;
+      size_t len = p[0] | (p[1] << 8);
+      if(_pos + 2 + len > _data.size()) {
+        _ok = false;
+        return string();
+      }
+      string s(_data, _pos + 2, len);
+      _pos += 2 + len;
+      return s;
+    }
+
+  private:
+    const string& _data;
+    size_t _pos;
+    bool _ok;
+  };
+
+  bool read_file(const string& path, string& contents, size_t expected)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd == -1) {
+      return false;
+    }
+
+    if(expected == string::npos) {
+      struct stat st;
+      if(fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+      }
+      expected = st.st_size;
+    }
+
+    contents.resize(expected);
+    size_t got = 0;
+    while(got < expected) {
+      ssize_t len = ::read(fd, &contents[got], expected - got);
+      if(len <= 0) {
+        break;
+      }
+      got += len;
+    }
+
+    close(fd);
+    return got == expected;
+  }
+
+  // Writes contents to path under a temporary name and renames it into
+  // place, so readers only ever see a complete file
+  bool write_file(const string& path, const char* data, size_t len, bool sync)
+  {
+    string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(fd == -1) {
+      return false;
+    }
+
+    size_t written = 0;
+    while(written < len) {
+      ssize_t n = ::write(fd, data + written, len - written);
+      if(n <= 0) {
+        break;
+      }
+      written += n;
+    }
+
+    bool ok = written == len && (!sync || fsync(fd) == 0);
+    ok = close(fd) == 0 && ok;
+    if(!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+      unlink(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+}
+
+DiskCache::DiskCache() :
+  _capacity(0), _bytes(0), _nextId(0), _unsaved(0), _hits(0), _misses(0),
+  _writes(256)
+{
+  _hand = _clock.end();
+}
+
+bool DiskCache::open(const string& dir, size_t capacity)
+{
+  if(mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+    return false;
+  }
+  if(access(dir.c_str(), R_OK | W_OK | X_OK) != 0) {
+    return false;
+  }
+
+  _dir = dir;
+  _capacity = capacity;
+
+  // Entries over the capacity are evicted as the index loads, and
+  // their files removed with the other strays
+  load();
+  reconcile();
+  return true;
+}
+
+void DiskCache::start()
+{
+  if(enabled()) {
+    _writes.start(1);
+  }
+}
+
+void DiskCache::stop()
+{
+  if(enabled()) {
+    _writes.stop();
+    save();
+  }
+}
+
+string DiskCache::chunkPath(unsigned id) const
+{
+  char name[16];
+  snprintf(name, sizeof(name), "/%08x", id);
+  return _dir + name;
+}
+
+void DiskCache::load()
+{
+  string data;
+  if(!read_file(_dir + "/index", data, string::npos) || data.size() < 12 ||
+     memcmp(data.data(), INDEX_MAGIC, 4) != 0) {
+    return;
+  }
+
+  IndexReader index(data);
+  index.readInt();
+  if(index.readInt() != INDEX_FORMAT) {
+    return;
+  }
+  _nextId = index.readInt();
+
+  vector<unsigned> unused;
+  while(!index.done()) {
+    Entry entry;
+    entry.id = index.readInt();
+    int n = index.readInt();
+    entry.size = index.readInt();
+    entry.crc = index.readInt();
+    string files_id = index.readString();
+    entry.version = index.readString();
+    if(!index.ok()) {
+      break;
+    }
+
+    insert(make_pair(files_id, n), entry, unused);
+    _nextId = max(_nextId, entry.id + 1);
+  }
+}
+
+// Removes files the index doesn't know about, such as chunks written
+// after the last save before a crash, and entries whose file is gone
+void DiskCache::reconcile()
+{
+  map<unsigned, Key> ids;
+  for(EntryMap::iterator i = _entries.begin(); i != _entries.end(); i++) {
+    ids[i->second.id] = i->first;
+  }
+
+  DIR* dir = opendir(_dir.c_str());
+  if(!dir) {
+    return;
+  }
+
+  set<unsigned> present;
+  while(struct dirent* ent = readdir(dir)) {
+    string name = ent->d_name;
+    if(name == "." || name == ".." || name == "index") {
+      continue;
+    }
+
+    char* end;
+    unsigned id = strtoul(name.c_str(), &end, 16);
+    if(*end == '\0' && ids.count(id)) {
+      present.insert(id);
+    } else {
+      unlink((_dir + "/" + name).c_str());
+    }
+  }
+  closedir(dir);
+
+  vector<unsigned> unused;
+  for(map<unsigned, Key>::iterator i = ids.begin(); i != ids.end(); i++) {
+    if(!present.count(i->first)) {
+      remove(_entries.find(i->second), unused);
+    }
+  }
+}
+
+void DiskCache::save()
+{
+  string data(INDEX_MAGIC, 4);
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+
+    append_int(data, INDEX_FORMAT);
+    append_int(data, _nextId);
+    for(EntryMap::iterator i = _entries.begin(); i != _entries.end(); i++) {
+      append_int(data, i->second.id);
+      append_int(data, i->first.second);
+      append_int(data, i->second.size);
+      append_int(data, i->second.crc);
+      append_string(data, i->first.first);
+      append_string(data, i->second.version);
+    }
+    _unsaved = 0;
+  }
+
+  write_file(_dir + "/index", data.data(), data.size(), true);
+}
+
+DiskCache::Chunk DiskCache::get(const string& files_id,
+                                const string& version, int n)
+{
+  if(!enabled() || version.empty()) {
+    return Chunk();
+  }
+
+  Key key(files_id, n);
+  unsigned id = 0, size = 0, sum = 0;
+  bool found = false;
+  vector<unsigned> victims;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+
+    EntryMap::iterator i = _entries.find(key);
+    if(i == _entries.end() || i->second.version != version) {
+      // An older version of a file that was rewritten in place
+      if(i != _entries.end()) {
+        remove(i, victims);
+      }
+      _misses++;
+    } else {
+      i->second.referenced = true;
+      found = true;
+      id = i->second.id;
+      size = i->second.size;
+      sum = i->second.crc;
+    }
+  }
+
+  if(!found) {
+    unlinkAll(victims);
+    return Chunk();
+  }
+
+  boost::shared_ptr<string> data(new string);
+  if(!read_file(chunkPath(id), *data, size) ||
+     crc(data->data(), data->size()) != sum) {
+    drop(key, id);
+    boost::mutex::scoped_lock lock(_mutex);
+    _misses++;
+    return Chunk();
+  }
+
+  boost::mutex::scoped_lock lock(_mutex);
+  _hits++;
+  return data;
+}
+
+bool DiskCache::contains(const string& files_id, const string& version, int n)
+{
+  if(!enabled() || version.empty()) {
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(_mutex);
+  EntryMap::iterator i = _entries.find(Key(files_id, n));
+  return i != _entries.end() && i->second.version == version;
+}
+
+void DiskCache::put(const string& files_id, const string& version, int n,
+                    const Chunk& chunk)
+{
+  if(!enabled() || version.empty() || chunk->size() > _capacity ||
+     contains(files_id, version, n)) {
+    return;
+  }
+
+  // Dropped if the disk can't keep up
+  _writes.push(boost::bind(&DiskCache::store, this, Key(files_id, n),
+                           version, chunk));
+}
+
+void DiskCache::store(const Key& key, const string& version,
+                      const Chunk& chunk)
+{
+  Entry entry;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    entry.id = _nextId++;
+  }
+  entry.size = chunk->size();
+  entry.crc = crc(chunk->data(), chunk->size());
+  entry.version = version;
+
+  // No fsync; a chunk lost in a crash fails its CRC and is dropped
+  if(!write_file(chunkPath(entry.id), chunk->data(), chunk->size(), false)) {
+    return;
+  }
+
+  vector<unsigned> victims;
+  bool save_index;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    insert(key, entry, victims);
+    save_index = ++_unsaved >= SAVE_EVERY;
+  }
+  unlinkAll(victims);
+
+  if(save_index) {
+    save();
+  }
+}
+
+// Called with _mutex held
+void DiskCache::insert(const Key& key, const Entry& entry,
+                       vector<unsigned>& victims)
+{
+  EntryMap::iterator existing = _entries.find(key);
+  if(existing != _entries.end()) {
+    remove(existing, victims);
+  }
+
+  // New entries go just behind the hand, so they're the last it reaches
+  Entry& added = _entries[key] = entry;
+  added.referenced = false;
+  added.pos = _clock.insert(_hand, key);
+  _bytes += entry.size;
+
+  while(_bytes > _capacity && !_clock.empty()) {
+    if(_hand == _clock.end()) {
+      _hand = _clock.begin();
+    }
+
+    EntryMap::iterator i = _entries.find(*_hand);
+    if(i->second.referenced) {
+      i->second.referenced = false;
+      _hand++;
+    } else {
+      remove(i, victims);
+    }
+  }
+}
+
+// Called with _mutex held
+void DiskCache::remove(EntryMap::iterator i, vector<unsigned>& victims)
+{
+  if(_hand == i->second.pos) {
+    _hand = _clock.erase(i->second.pos);
+  } else {
+    _clock.erase(i->second.pos);
+  }
+
+  _bytes -= i->second.size;
+  victims.push_back(i->second.id);
+  _entries.erase(i);
+}
+
+// Drops the entry for key if it still refers to the file id
+void DiskCache::drop(const Key& key, unsigned id)
+{
+  vector<unsigned> victims;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    EntryMap::iterator i = _entries.find(key);
+    if(i != _entries.end() && i->second.id == id) {
+      remove(i, victims);
+    }
+  }
+  unlinkAll(victims);
+}
+
+void DiskCache::unlinkAll(const vector<unsigned>& ids)
+{
+  for(vector<unsigned>::const_iterator i = ids.begin(); i != ids.end(); i++) {
+    unlink(chunkPath(*i).c_str());
+  }
+}
+
+unsigned long long DiskCache::hits()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _hits;
+}
+
+unsigned long long DiskCache::misses()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _misses;
+}
+
+size_t DiskCache::size()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _bytes;
+}
@@ -0,0 +1,115 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __DISK_CACHE_H
+#define __DISK_CACHE_H
+
+#include "chunk_cache.h"
+#include "work_queue.h"
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+// Chunks kept in a local directory so they outlive the mount. Entries
+// are keyed like the chunk cache by (files_id, n) and tagged with the
+// version of the file they were read from; a lookup made for any
+// other version misses and drops the entry. Each chunk lives in its own
+// file and a compact index of all of them is saved alongside, so
+// mounting only has to read the index and list the directory.
+//
+// A chunk is written under a temporary name and renamed into place, and
+// checked against the CRC in its index entry when it's read back, so a
+// crash can only ever lose entries. Eviction is CLOCK, which only has to
+// set a flag on a hit.
+class DiskCache {
+public:
+  typedef ChunkCache::Chunk Chunk;
+  typedef ChunkCache::Key Key;
+
+  DiskCache();
+
+  // Loads the index from dir, creating the directory if needed. Returns
+  // false if it can't be used.
+  bool open(const std::string& dir, size_t capacity);
+  bool enabled() const { return !_dir.empty(); }
+
+  // The thread that writes chunks to disk
+  void start();
+  // Finishes queued writes and saves the index
+  void stop();
+
+  // Returns an empty pointer on a miss
+  Chunk get(const std::string& files_id, const std::string& version, int n);
+  bool contains(const std::string& files_id, const std::string& version,
+                int n);
+  // Queues the chunk to be written. Chunks of files without a version
+  // aren't kept.
+  void put(const std::string& files_id, const std::string& version, int n,
+           const Chunk& chunk);
+
+  unsigned long long hits();
+  unsigned long long misses();
+  size_t size();
+
+private:
+  // Index saves are batched over this many new entries
+  static const int SAVE_EVERY = 1024;
+
+  struct Entry {
+    unsigned id;
+    unsigned size;
+    unsigned crc;
+    std::string version;
+    bool referenced;
+    std::list<Key>::iterator pos;
+  };
+
+  typedef std::map<Key, Entry> EntryMap;
+
+  std::string chunkPath(unsigned id) const;
+  void load();
+  void reconcile();
+  void save();
+  void store(const Key& key, const std::string& version, const Chunk& chunk);
+  // Called with _mutex held. Ids of files to remove are added to victims.
+  void insert(const Key& key, const Entry& entry,
+              std::vector<unsigned>& victims);
+  void remove(EntryMap::iterator i, std::vector<unsigned>& victims);
+  void drop(const Key& key, unsigned id);
+  void unlinkAll(const std::vector<unsigned>& ids);
+
+  std::string _dir;
+  size_t _capacity;
+  boost::mutex _mutex;
+  EntryMap _entries;
+  std::list<Key> _clock;
+  std::list<Key>::iterator _hand;
+  size_t _bytes;
+  unsigned _nextId;
+  int _unsaved;
+  unsigned long long _hits, _misses;
+  WorkQueue _writes;
+};
+
+extern DiskCache disk_cache;
+
+#endif
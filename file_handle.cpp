@@ -0,0 +1,235 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file_handle.h"
+#include "disk_cache.h"
+#include "metrics.h"
+#include "storage.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include <boost/ref.hpp>
+
+using namespace std;
+using namespace mongo;
+
+bool FileHandle::load()
+{
+  if(exists()) {
+    return true;
+  }
+
+  BSONObj file = storage->findFile(_path);
+  if(file.isEmpty()) {
+    return false;
+  }
+
+  // Another thread may have loaded it meanwhile, and be reading
+  boost::mutex::scoped_lock lock(_fileMutex);
+  if(_file.isEmpty()) {
+    assign(file);
+  }
+  return true;
+}
+
+bool FileHandle::exists() const
+{
+  boost::mutex::scoped_lock lock(_fileMutex);
+  return !_file.isEmpty();
+}
+
+bool FileHandle::getFile(BSONObj& file) const
+{
+  boost::mutex::scoped_lock lock(_fileMutex);
+  file = _file;
+  return !file.isEmpty();
+}
+
+void FileHandle::setFile(const BSONObj& file)
+{
+  boost::mutex::scoped_lock lock(_fileMutex);
+  assign(file);
+}
+
+// Called with _fileMutex held
+void FileHandle::assign(const BSONObj& file)
+{
+  _file = file.getOwned();
+  _cacheId = id().toString(false);
+  _version = file_version(_file);
+  _chunkSize = _file["chunkSize"].numberInt();
+  _length = _file["length"].numberLong();
+  _uploadDate = _file["uploadDate"].date();
+  _numChunks = _chunkSize ? (_length + _chunkSize - 1) / _chunkSize : 0;
+}
+
+string file_version(const BSONObj& file)
+{
+  if(file["md5"].type() != String) {
+    return string();
+  }
+
+  ostringstream version;
+  version << (unsigned long long)file["uploadDate"].date() << " "
+          << file["md5"].valuestr();
+  return version.str();
+}
+
+namespace {
+  // Wraps each chunk off the backend for the caches and the caller's sink
+  class ChunkWrapper {
+  public:
+    ChunkWrapper(const string& cacheId, const string& version,
+                 const ChunkSink& sink, bool cache) :
+      _cacheId(cacheId), _version(version), _sink(sink), _cache(cache) {}
+
+    void operator()(int n, const char* data, int len) {
+      ChunkCache::Chunk chunk(new string(data, len));
+      if(_cache) {
+        chunk_cache.put(_cacheId, n, chunk);
+        disk_cache.put(_cacheId, _version, n, chunk);
+      }
+      if(_sink) {
+        _sink(n, chunk);
+      }
+    }
+
+  private:
+    const string& _cacheId;
+    const string& _version;
+    const ChunkSink& _sink;
+    bool _cache;
+  };
+}
+
+int fetch_chunks(const BSONObj& file, int first, int last,
+                 const ChunkSink& sink, bool cache)
+{
+  string cache_id = file["_id"].toString(false);
+  string version = cache ? file_version(file) : string();
+  int fetched = storage->fetchChunks(BSON("_id" << file["_id"]), first, last,
+                                     ChunkWrapper(cache_id, version, sink,
+                                                  cache));
+
+  metrics.add(Metrics::CHUNKS_FETCHED, fetched);
+  return fetched;
+}
+
+namespace {
+  // Copies each chunk's overlap with the requested range into the
+  // caller's buffer as it arrives
+  class ChunkCopier {
+  public:
+    ChunkCopier(char* buf, size_t size, off_t offset, int chunkSize,
+                int first, int last) :
+      _buf(buf), _size(size), _offset(offset), _chunkSize(chunkSize),
+      _first(first), _got(last - first + 1, false) {}
+
+    void operator()(int n, const ChunkCache::Chunk& chunk) {
+      off_t chunk_start = (off_t)n * _chunkSize;
+      off_t from = max(_offset, chunk_start);
+      off_t to = min((off_t)(_offset + _size),
+                     chunk_start + (off_t)chunk->size());
+      if(from < to) {
+        memcpy(_buf + (from - _offset), chunk->data() + (from - chunk_start),
+               to - from);
+      }
+      _got[n - _first] = true;
+    }
+
+    // Number of bytes copied before the first chunk that never arrived
+    size_t copied() const {
+      for(size_t i = 0; i < _got.size(); i++) {
+        if(!_got[i]) {
+          off_t missing = (off_t)(_first + i) * _chunkSize;
+          return missing > _offset ? missing - _offset : 0;
+        }
+      }
+      return _size;
+    }
+
+  private:
+    char* _buf;
+    size_t _size;
+    off_t _offset;
+    int _chunkSize;
+    int _first;
+    vector<bool> _got;
+  };
+}
+
+int FileHandle::read(char* buf, size_t size, off_t offset, bool cache)
+{
+  if(offset >= _length) {
+    return 0;
+  }
+
+  if(cache) {
+    read_ahead.onRead(*this, offset, size);
+  }
+
+  size = min<long long>(size, _length - offset);
+  int first = offset / _chunkSize;
+  int last = (offset + size - 1) / _chunkSize;
+  ChunkCopier copier(buf, size, offset, _chunkSize, first, last);
+
+  // Serve what we can from memory, then the disk cache, and fetch each
+  // run of missing chunks with a single query
+  if(!cache) {
+    fetch_chunks(_file, first, last + 1, boost::ref(copier), false);
+    return copier.copied();
+  }
+
+  int n = first;
+  while(n <= last) {
+    ChunkCache::Chunk chunk = chunk_cache.get(_cacheId, n);
+    if(!chunk) {
+      chunk = disk_cache.get(_cacheId, _version, n);
+      if(chunk) {
+        chunk_cache.put(_cacheId, n, chunk);
+      }
+    }
+    if(chunk) {
+      copier(n, chunk);
+      n++;
+      continue;
+    }
+
+    int run_end = n + 1;
+    while(run_end <= last && !chunk_cache.contains(_cacheId, run_end) &&
+          !disk_cache.contains(_cacheId, _version, run_end)) {
+      run_end++;
+    }
+
+    fetch_chunks(_file, n, run_end, boost::ref(copier));
+    n = run_end;
+  }
+
+  return copier.copied();
+}
+
+int FileHandle::readContents(char* buf, size_t size, off_t offset)
+{
+  if(offset >= (off_t)_contents.size()) {
+    return 0;
+  }
+
+  size = min<size_t>(size, _contents.size() - offset);
+  memcpy(buf, _contents.data() + offset, size);
+  return size;
+}
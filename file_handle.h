@@ -0,0 +1,125 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FILE_HANDLE_H
+#define __FILE_HANDLE_H
+
+#include "chunk_cache.h"
+#include "read_ahead.h"
+#include "gridfile_writer.h"
+#include <string>
+#include <sys/types.h>
+
+#include <boost/function.hpp>
+
+#include <mongo/client/dbclient.h>
+
+// State for one open() of a file, stored in fuse_file_info::fh. Holds the
+// fs.files document resolved at open time so that reads only have to
+// fetch chunks. The document is set before the handle is shared, or by
+// the first load() to finish, and never changes after that; the
+// accessors below may be used without a lock once exists() is true.
+class FileHandle {
+public:
+  FileHandle(const std::string& path, const WriterPtr& writer = WriterPtr()) :
+    _path(path), _writer(writer), _readWriter(writer), _chunkSize(0),
+    _length(0),
+    _numChunks(0), _uploadDate(0), _virtual(false), _append(false) {}
+
+  const std::string& path() const { return _path; }
+  bool writable() const { return _writer.get() != NULL; }
+  const WriterPtr& writer() const { return _writer; }
+  // The writer reads go through instead of mongod: the handle's own, or
+  // the one a file had when it was opened for reading, if any. Set at
+  // open so reads never have to look it up.
+  const WriterPtr& readWriter() const { return _readWriter; }
+  void setReadWriter(const WriterPtr& writer) { _readWriter = writer; }
+  // Opened with O_APPEND, so every write goes to the end
+  bool append() const { return _append; }
+  void setAppend(bool append) { _append = append; }
+
+  // Looks the file up in fs.files by name unless it already has been.
+  // Returns false if it doesn't exist. Safe to race with reads.
+  bool load();
+  // Only for a handle no other thread has yet
+  void setFile(const mongo::BSONObj& file);
+
+  bool exists() const;
+  // Copy of the fs.files document that's safe to take from other threads
+  bool getFile(mongo::BSONObj& file) const;
+  const mongo::BSONObj& file() const { return _file; }
+  mongo::BSONElement id() const { return _file["_id"]; }
+  mongo::BSONObj metadata() const { return _file.getObjectField("metadata"); }
+  int getChunkSize() const { return _chunkSize; }
+  long long getLength() const { return _length; }
+  int getNumChunks() const { return _numChunks; }
+  unsigned long long getUploadDate() const { return _uploadDate; }
+
+  // Key for this file's chunks in the chunk cache
+  const std::string& cacheId() const { return _cacheId; }
+  // Tags this file's chunks in the disk cache
+  const std::string& version() const { return _version; }
+
+  ReadAheadState& readAheadState() { return _readAhead; }
+
+  // Reads through the chunk cache and read-ahead unless cache is false
+  int read(char* buf, size_t size, off_t offset, bool cache = true);
+
+  // Handles on the mount's own virtual files hold a snapshot of the
+  // contents taken at open instead of an fs.files document
+  void setContents(const std::string& contents) {
+    _contents = contents;
+    _virtual = true;
+  }
+  bool isVirtual() const { return _virtual; }
+  int readContents(char* buf, size_t size, off_t offset);
+
+private:
+  void assign(const mongo::BSONObj& file);
+
+  std::string _path;
+  WriterPtr _writer;
+  WriterPtr _readWriter;
+  mutable boost::mutex _fileMutex;
+  mongo::BSONObj _file;
+  std::string _cacheId;
+  std::string _version;
+  int _chunkSize;
+  long long _length;
+  int _numChunks;
+  unsigned long long _uploadDate;
+  ReadAheadState _readAhead;
+  bool _virtual;
+  std::string _contents;
+  bool _append;
+};
+
+typedef boost::function<void (int, const ChunkCache::Chunk&)> ChunkSink;
+
+// What a cached chunk has to have been read from to still be current:
+// the uploadDate and md5 that every flush rewrites. Empty for documents
+// that aren't a flushed file.
+std::string file_version(const mongo::BSONObj& file);
+
+// Fetches chunks [first, last) of the fs.files document file with a
+// single query sorted by n. Each chunk is added to the chunk and disk
+// caches, unless cache is false, and handed to sink as it comes off the cursor.
+// Returns the number of chunks fetched.
+int fetch_chunks(const mongo::BSONObj& file, int first, int last,
+                 const ChunkSink& sink = ChunkSink(), bool cache = true);
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "file_table.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+using namespace mongo;
+
+typedef boost::shared_lock<boost::shared_mutex> ReadLock;
+typedef boost::unique_lock<boost::shared_mutex> WriteLock;
+
+bool FileTable::NameLess::operator()(const Entry* e, const string& name) const
+{
+  return name.compare(0, string::npos, e->name(), e->nameLen) > 0;
+}
+
+char* FileTable::allocate(size_t bytes)
+{
+  bytes = (bytes + 7) & ~(size_t)7;
+
+  // Anything bigger than a block gets a block of its own
+  if(bytes > BLOCK_SIZE) {
+    char* block = new char[bytes];
+    _blocks.insert(_blocks.end() - (_blocks.empty() ? 0 : 1), block);
+    _arenaBytes += bytes;
+    return block;
+  }
+
+  if(_blockUsed + bytes > BLOCK_SIZE) {
+    _blocks.push_back(new char[BLOCK_SIZE]);
+    _blockUsed = 0;
+    _arenaBytes += BLOCK_SIZE;
+  }
+
+  char* p = _blocks.back() + _blockUsed;
+  _blockUsed += bytes;
+  return p;
+}
+
+FileTable::Entry* FileTable::make(const BSONObj& file)
+{
+  BSONObj id = BSON("_id" << file["_id"]);
+  const char* name = file.getStringField("filename");
+  const char* md5 = file.getStringField("md5");
+  BSONObj metadata = file.getObjectField("metadata");
+
+  size_t name_len = strlen(name);
+  size_t md5_len = strlen(md5);
+  size_t metadata_len = metadata.isEmpty() ? 0 : metadata.objsize();
+
+  Entry* e = (Entry*)allocate(sizeof(Entry) + name_len + 1 + id.objsize() +
+                              md5_len + metadata_len);
+  e->length = file["length"].numberLong();
+  e->uploadDate = file["uploadDate"].date();
+  e->chunkSize = file["chunkSize"].numberInt();
+  e->nameLen = name_len;
+  e->idLen = id.objsize();
+  e->md5Len = md5_len;
+  e->metadataLen = metadata_len;
+
+  memcpy((char*)e->name(), name, name_len + 1);
+  memcpy((char*)e->id(), id.objdata(), id.objsize());
+  memcpy((char*)e->md5(), md5, md5_len);
+  if(metadata_len) {
+    memcpy((char*)e->metadata(), metadata.objdata(), metadata_len);
+  }
+  return e;
+}
+
+// Called with _mutex held exclusively, after e has left the index
+void FileTable::retire(const Entry* e)
+{
+  _deadBytes += e->size();
+  if(_arenaBytes > BLOCK_SIZE && _deadBytes > _arenaBytes / 2) {
+    compact();
+  }
+}
+
+// Copies every indexed entry into new blocks and frees the old ones.
+// Called with _mutex held exclusively.
+void FileTable::compact()
+{
+  vector<char*> old;
+  old.swap(_blocks);
+  _blockUsed = BLOCK_SIZE;
+  _arenaBytes = 0;
+  _deadBytes = 0;
+
+  for(Index::iterator i = _index.begin(); i != _index.end(); i++) {
+    size_t size = (*i)->size();
+    Entry* e = (Entry*)allocate(size);
+    memcpy(e, *i, size);
+    *i = e;
+  }
+
+  for(vector<char*>::iterator i = old.begin(); i != old.end(); i++) {
+    delete [] *i;
+  }
+}
+
+BSONObj FileTable::toBSON(const Entry* e) const
+{
+  BSONObjBuilder b;
+  b.append(BSONObj(e->id()).firstElement());
+  b << "filename" << string(e->name(), e->nameLen)
+    << "length" << e->length
+    << "chunkSize" << e->chunkSize;
+  b.appendDate("uploadDate", Date_t(e->uploadDate));
+  if(e->md5Len) {
+    b << "md5" << string(e->md5(), e->md5Len);
+  }
+  if(e->metadataLen) {
+    b << "metadata" << BSONObj(e->metadata());
+  }
+  return b.obj();
+}
+
+FileTable::Index::const_iterator FileTable::lowerBound(const string& name) const
+{
+  return lower_bound(_index.begin(), _index.end(), name, NameLess());
+}
+
+static bool named(const char* entry_name, size_t len, const string& name)
+{
+  return name.size() == len && name.compare(0, len, entry_name, len) == 0;
+}
+
+void FileTable::put(const BSONObj& file)
+{
+  string name = file.getStringField("filename");
+  WriteLock lock(_mutex);
+
+  Entry* e = make(file);
+  if(_index.empty() || NameLess()(_index.back(), name)) {
+    _index.push_back(e);
+    return;
+  }
+
+  Index::iterator i = _index.begin() + (lowerBound(name) - _index.begin());
+  if(i != _index.end() && named((*i)->name(), (*i)->nameLen, name)) {
+    Entry* old = *i;
+    *i = e;
+    retire(old);
+  } else {
+    _index.insert(i, e);
+  }
+}
+
+bool FileTable::remove(const string& filename)
+{
+  WriteLock lock(_mutex);
+
+  Index::iterator i = _index.begin() + (lowerBound(filename) - _index.begin());
+  if(i == _index.end() || !named((*i)->name(), (*i)->nameLen, filename)) {
+    return false;
+  }
+
+  Entry* old = *i;
+  _index.erase(i);
+  retire(old);
+  return true;
+}
+
+void FileTable::clear()
+{
+  WriteLock lock(_mutex);
+
+  for(vector<char*>::iterator i = _blocks.begin(); i != _blocks.end(); i++) {
+    delete [] *i;
+  }
+  _blocks.clear();
+  _index.clear();
+  _blockUsed = BLOCK_SIZE;
+  _arenaBytes = 0;
+  _deadBytes = 0;
+}
+
+BSONObj FileTable::find(const string& filename) const
+{
+  ReadLock lock(_mutex);
+
+  Index::const_iterator i = lowerBound(filename);
+  if(i == _index.end() || !named((*i)->name(), (*i)->nameLen, filename)) {
+    return BSONObj();
+  }
+  return toBSON(*i);
+}
+
+void FileTable::list(const string& lower, const string& upper,
+                     const FileSink& sink, int limit) const
+{
+  ReadLock lock(_mutex);
+
+  int listed = 0;
+  for(Index::const_iterator i = lowerBound(lower); i != _index.end(); i++) {
+    if((!upper.empty() && !NameLess()(*i, upper)) ||
+       (limit && listed == limit)) {
+      break;
+    }
+
+    listed++;
+    if(!sink(toBSON(*i))) {
+      break;
+    }
+  }
+}
+
+int FileTable::position(const string& filename) const
+{
+  ReadLock lock(_mutex);
+
+  Index::const_iterator i = lowerBound(filename);
+  if(i == _index.end() || !named((*i)->name(), (*i)->nameLen, filename)) {
+    return -1;
+  }
+  return i - _index.begin();
+}
+
+string FileTable::filenameAt(int i) const
+{
+  ReadLock lock(_mutex);
+  return string(_index[i]->name(), _index[i]->nameLen);
+}
+
+bool FileTable::sameId(int i, const BSONElement& id) const
+{
+  BSONObj wrapped = BSON("_id" << id);
+
+  ReadLock lock(_mutex);
+  return (int)_index[i]->idLen == wrapped.objsize() &&
+    memcmp(_index[i]->id(), wrapped.objdata(), wrapped.objsize()) == 0;
+}
+
+size_t FileTable::size() const
+{
+  ReadLock lock(_mutex);
+  return _index.size();
+}
+
+size_t FileTable::bytes() const
+{
+  ReadLock lock(_mutex);
+  return _arenaBytes + _index.capacity() * sizeof(Entry*);
+}
@@ -0,0 +1,115 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __FILE_TABLE_H
+#define __FILE_TABLE_H
+
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+#include <mongo/client/dbclient.h>
+
+// The fields of fs.files that lookups need, for one document per
+// filename, packed into large arena blocks instead of a BSONObj and a
+// heap allocation apiece. Entries are indexed by a vector sorted on
+// filename; documents that come in filename order, as a bulk scan's do,
+// are appended without moving anything. Replaced and removed entries
+// leave their space behind; once that's over half the arena, the live
+// entries are copied into fresh blocks and the old ones freed, so a
+// table that keeps being updated stays about the size of what it holds.
+class FileTable {
+public:
+  typedef boost::function<bool (const mongo::BSONObj&)> FileSink;
+
+  FileTable() : _blockUsed(BLOCK_SIZE), _arenaBytes(0), _deadBytes(0) {}
+  ~FileTable() { clear(); }
+
+  // Adds file, replacing any entry with the same filename
+  void put(const mongo::BSONObj& file);
+  bool remove(const std::string& filename);
+  void clear();
+
+  // The entry as a document with filename, _id, length, chunkSize,
+  // uploadDate, md5 and metadata, or an empty object
+  mongo::BSONObj find(const std::string& filename) const;
+  // Like Storage::listFiles
+  void list(const std::string& lower, const std::string& upper,
+            const FileSink& sink, int limit = 0) const;
+
+  // Position of filename in filename order, or -1. Positions only stay
+  // put while nothing is added or removed.
+  int position(const std::string& filename) const;
+  std::string filenameAt(int i) const;
+  bool sameId(int i, const mongo::BSONElement& id) const;
+
+  size_t size() const;
+  // Bytes held by the arena and the index
+  size_t bytes() const;
+
+private:
+  static const size_t BLOCK_SIZE = 1024 * 1024;
+
+  // Followed in the arena by the filename, the _id wrapped in a
+  // document, md5 and the raw metadata document
+  struct Entry {
+    long long length;
+    long long uploadDate;
+    int chunkSize;
+    unsigned nameLen;
+    unsigned idLen;
+    unsigned md5Len;
+    unsigned metadataLen;
+
+    const char* name() const { return (const char*)(this + 1); }
+    const char* id() const { return name() + nameLen + 1; }
+    const char* md5() const { return id() + idLen; }
+    const char* metadata() const { return md5() + md5Len; }
+    // Bytes the entry takes in the arena
+    size_t size() const {
+      return (sizeof(Entry) + nameLen + 1 + idLen + md5Len + metadataLen + 7) &
+        ~(size_t)7;
+    }
+  };
+
+  typedef std::vector<Entry*> Index;
+
+  struct NameLess {
+    bool operator()(const Entry* e, const std::string& name) const;
+  };
+
+  // Called with _mutex held exclusively
+  Entry* make(const mongo::BSONObj& file);
+  char* allocate(size_t bytes);
+  void retire(const Entry* e);
+  void compact();
+  Index::const_iterator lowerBound(const std::string& name) const;
+  mongo::BSONObj toBSON(const Entry* e) const;
+
+  mutable boost::shared_mutex _mutex;
+  Index _index;
+  std::vector<char*> _blocks;
+  size_t _blockUsed;
+  size_t _arenaBytes;
+  // Arena bytes of entries that are no longer indexed
+  size_t _deadBytes;
+};
+
+#endif
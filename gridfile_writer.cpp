@@ -0,0 +1,518 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gridfile_writer.h"
+#include "file_handle.h"
+#include "chunk_cache.h"
+#include "chunk_gc.h"
+#include "metrics.h"
+#include "open_file_table.h"
+#include "options.h"
+#include "stat_cache.h"
+#include "storage.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+
+using namespace std;
+using namespace mongo;
+
+WorkQueue upload_queue;
+
+GridFileWriter::GridFileWriter(const string& filename, int chunkSize) :
+  _filename(filename), _lgf(chunkSize), _id(BSON("_id" << OID::gen())),
+  _stored(false), _pending(0), _failed(false), _retry(false)
+{
+}
+
+// The md5state field saved with a file: a version tag, the md5 it was
+// saved with, and the hash state as its six 32 bit words little endian
+// followed by its 64 byte input buffer, so any host reads it the same
+static const int MD5_STATE_VERSION = 1;
+static const int MD5_STATE_WORDS = 6;
+static const int MD5_STATE_SIZE = MD5_STATE_WORDS * 4 + 64;
+
+static BSONObj encode_md5_state(const md5_state_t& state, const string& md5)
+{
+  md5_word_t words[MD5_STATE_WORDS] = {
+    state.count[0], state.count[1],
+    state.abcd[0], state.abcd[1], state.abcd[2], state.abcd[3]
+  };
+
+  char encoded[MD5_STATE_SIZE];
+  for(int i = 0; i < MD5_STATE_WORDS; i++) {
+    for(int b = 0; b < 4; b++) {
+      encoded[i * 4 + b] = (char)((words[i] >> (8 * b)) & 0xff);
+    }
+  }
+  memcpy(encoded + MD5_STATE_WORDS * 4, state.buf, 64);
+
+  BSONObjBuilder saved;
+  saved << "v" << MD5_STATE_VERSION << "md5" << md5;
+  saved.appendBinData("state", MD5_STATE_SIZE, BinDataGeneral, encoded);
+  return saved.obj();
+}
+
+// The hash of the file's full chunks that the last flush through the
+// mount left, if the file hasn't been written to any other way since
+static auto_ptr<md5_state_t> saved_md5_state(const BSONObj& file)
+{
+  auto_ptr<md5_state_t> state;
+
+  BSONObj saved = file.getObjectField("md5state");
+  if(saved.isEmpty() || saved["v"].numberInt() != MD5_STATE_VERSION ||
+     saved["state"].type() != BinData ||
+     strcmp(saved.getStringField("md5"), file.getStringField("md5")) != 0) {
+    return state;
+  }
+
+  int len;
+  const unsigned char* encoded =
+    (const unsigned char*)saved["state"].binData(len);
+  if(len != MD5_STATE_SIZE) {
+    return state;
+  }
+
+  md5_word_t words[MD5_STATE_WORDS];
+  for(int i = 0; i < MD5_STATE_WORDS; i++) {
+    words[i] = 0;
+    for(int b = 0; b < 4; b++) {
+      words[i] |= (md5_word_t)encoded[i * 4 + b] << (8 * b);
+    }
+  }
+
+  state.reset(new md5_state_t);
+  state->count[0] = words[0];
+  state->count[1] = words[1];
+  for(int i = 0; i < 4; i++) {
+    state->abcd[i] = words[2 + i];
+  }
+  memcpy(state->buf, encoded + MD5_STATE_WORDS * 4, 64);
+  return state;
+}
+
+GridFileWriter::GridFileWriter(const BSONObj& file) :
+  _filename(file.getStringField("filename")),
+  _lgf(file["chunkSize"].numberInt(), file["length"].numberLong(),
+       saved_md5_state(file).get()),
+  _id(BSON("_id" << file["_id"])), _stored(true),
+  _pending(0), _failed(false), _retry(false)
+{
+}
+
+GridFileWriter::~GridFileWriter()
+{
+  waitForUploads();
+
+  // Chunks of a new file that never made it into fs.files, because a
+  // flush failed
+  if(!_stored && _lgf.dirty()) {
+    chunk_gc.collect(_id);
+  }
+}
+
+bool GridFileWriter::stored()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _stored;
+}
+
+bool GridFileWriter::usesFile(const string& cacheId)
+{
+  return _id["_id"].toString(false) == cacheId;
+}
+
+off_t GridFileWriter::getLength()
+{
+  boost::mutex::scoped_lock lock(_lock);
+  return _lgf.getLength();
+}
+
+int GridFileWriter::write(const char* buf, size_t nbyte, off_t offset)
+{
+  boost::mutex::scoped_lock lock(_lock);
+  return writeAt(buf, nbyte, offset);
+}
+
+int GridFileWriter::append(const char* buf, size_t nbyte)
+{
+  boost::mutex::scoped_lock lock(_lock);
+  return writeAt(buf, nbyte, _lgf.getLength());
+}
+
+// Called with _lock held
+int GridFileWriter::writeAt(const char* buf, size_t nbyte, off_t offset)
+{
+  if(!loadChunks(offset, nbyte)) {
+    return -EIO;
+  }
+
+  int written = _lgf.write(buf, nbyte, offset);
+
+  while(_lgf.getReleasedChunks() < _lgf.getSealedChunks()) {
+    int n = _lgf.getReleasedChunks();
+    ChunkBuffer chunk = _lgf.releaseChunk();
+    dispatch(boost::bind(&GridFileWriter::upload, this,
+                         n, chunk, _lgf.getChunkSize()));
+  }
+
+  return written;
+}
+
+// Waits for one of the file's upload slots and hands the job to the
+// upload threads, each of which holds its own pooled connection
+void GridFileWriter::dispatch(const WorkQueue::Job& job)
+{
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    while(_pending >= (int)max(1u, gridfs_options.upload_inflight)) {
+      _cond.wait(lock);
+    }
+    _pending++;
+  }
+
+  if(!upload_queue.push(job)) {
+    job();
+  }
+}
+
+bool GridFileWriter::send(int n, const char* data, int len)
+{
+  bool ok = false;
+
+  try {
+    ok = storage->putChunk(_id, n, data, len);
+
+    // Could be a chunk of an earlier flush that readers have cached
+    chunk_cache.erase(_id["_id"].toString(false), n);
+    metrics.add(Metrics::CHUNKS_UPLOADED);
+  } catch(DBException& e) {
+    cerr << "gridfs-fuse: uploading chunk " << n << " of " << _filename
+         << " failed: " << e.what() << endl;
+  }
+
+  return ok;
+}
+
+// A chunk released while writing sequentially. Its buffer is gone once
+// this returns, so a failure loses data for good.
+void GridFileWriter::upload(int n, ChunkBuffer chunk, int len)
+{
+  bool ok = send(n, chunk.data, len);
+  free_chunk(chunk, len);
+
+  boost::mutex::scoped_lock lock(_mutex);
+  if(!ok) {
+    _failed = true;
+  }
+  uploaded();
+}
+
+// A dirty chunk sent by flush, which keeps its buffer (and the file's
+// lock) until every upload is back. A failure leaves the chunk dirty
+// for the next flush to retry.
+void GridFileWriter::uploadBuffered(int n, const char* data, int len)
+{
+  bool ok = send(n, data, len);
+
+  boost::mutex::scoped_lock lock(_mutex);
+  if(!ok) {
+    _retry = true;
+  }
+  uploaded();
+}
+
+// Called with _mutex held
+void GridFileWriter::uploaded()
+{
+  _pending--;
+  _cond.notify_all();
+}
+
+void GridFileWriter::waitForUploads()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  while(_pending > 0) {
+    _cond.wait(lock);
+  }
+}
+
+namespace {
+  class ChunkLoader {
+  public:
+    ChunkLoader(LocalGridFile& lgf) : _lgf(lgf), _loaded(false) {}
+
+    void operator()(int n, const ChunkCache::Chunk& chunk) {
+      _lgf.loadChunk(n, chunk->data(), chunk->size());
+      _loaded = true;
+    }
+
+    bool loaded() const { return _loaded; }
+
+  private:
+    LocalGridFile& _lgf;
+    bool _loaded;
+  };
+}
+
+bool GridFileWriter::loadChunk(int n)
+{
+  ChunkLoader loader(_lgf);
+  fetch_chunks(_id, n, n + 1, boost::ref(loader), false);
+  return loader.loaded();
+}
+
+// Fetches the stored chunks that writing nbyte at offset would only
+// partly overwrite: the ones at either end of the range, and a partial
+// last chunk the write would pad out. Called with _lock held.
+bool GridFileWriter::loadChunks(off_t offset, size_t nbyte)
+{
+  if(!nbyte) {
+    return true;
+  }
+
+  int chunk_size = _lgf.getChunkSize();
+  off_t length = _lgf.getLength();
+  off_t end = offset + nbyte;
+
+  vector<int> needed;
+  int ends[2] = { (int)(offset / chunk_size), (int)((end - 1) / chunk_size) };
+  for(int i = 0; i < 2; i++) {
+    int n = ends[i];
+    if(n >= _lgf.getNumChunks() || _lgf.isLocal(n) ||
+       find(needed.begin(), needed.end(), n) != needed.end()) {
+      continue;
+    }
+
+    off_t start = (off_t)n * chunk_size;
+    if(offset > start || end < min<off_t>(start + chunk_size, length)) {
+      needed.push_back(n);
+    }
+  }
+
+  if(offset > length && length % chunk_size) {
+    int tail = length / chunk_size;
+    if(!_lgf.isLocal(tail) &&
+       find(needed.begin(), needed.end(), tail) == needed.end()) {
+      needed.push_back(tail);
+    }
+  }
+
+  if(needed.empty()) {
+    return true;
+  }
+
+  // A released chunk may not have reached mongod yet
+  waitForUploads();
+  for(vector<int>::iterator n = needed.begin(); n != needed.end(); n++) {
+    if(!loadChunk(*n)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int GridFileWriter::read(char* buf, size_t size, off_t offset)
+{
+  boost::mutex::scoped_lock lock(_lock);
+
+  off_t length = _lgf.getLength();
+  if(offset >= length) {
+    return 0;
+  }
+  size = min<off_t>(size, length - offset);
+
+  // Each run of chunks is read from the buffer or from mongod,
+  // whichever holds it
+  int chunk_size = _lgf.getChunkSize();
+  size_t done = 0;
+  while(done < size) {
+    off_t pos = offset + done;
+    int n = pos / chunk_size;
+    bool local = _lgf.isLocal(n);
+
+    int run_end = n + 1;
+    while((off_t)run_end * chunk_size < (off_t)(offset + size) &&
+          _lgf.isLocal(run_end) == local) {
+      run_end++;
+    }
+
+    size_t len = min<off_t>(size - done, (off_t)run_end * chunk_size - pos);
+    int got = local ? _lgf.read(buf + done, len, pos) :
+      readRemote(buf + done, len, pos);
+    if(got < 0) {
+      return got;
+    }
+
+    done += got;
+    if(got < (int)len) {
+      break;
+    }
+  }
+
+  return done;
+}
+
+// Called with _lock held
+int GridFileWriter::readRemote(char* buf, size_t size, off_t offset)
+{
+  waitForUploads();
+
+  BSONObj file = BSON("_id" << _id["_id"]
+                      << "chunkSize" << _lgf.getChunkSize()
+                      << "length" << (long long)_lgf.getLength());
+  FileHandle uploaded(_filename);
+  uploaded.setFile(file);
+
+  return uploaded.read(buf, size, offset, false);
+}
+
+int GridFileWriter::flush()
+{
+  boost::mutex::scoped_lock lock(_lock);
+
+  if(!_lgf.dirty()) {
+    return 0;
+  }
+
+  int chunk_size = _lgf.getChunkSize();
+  long long length = _lgf.getLength();
+
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _retry = false;
+  }
+
+  // Chunks that changed since the last flush and weren't streamed out
+  // while writing go through the same pipeline, straight from their
+  // buffers
+  for(int n = 0; (long long)n * chunk_size < length; n++) {
+    if(!_lgf.dirty(n)) {
+      continue;
+    }
+
+    int len = min<long long>(chunk_size, length - (long long)n * chunk_size);
+    dispatch(boost::bind(&GridFileWriter::uploadBuffered, this,
+                         n, _lgf.getChunk(n), len));
+  }
+
+  // fs.files is only written once every chunk has been acknowledged
+  waitForUploads();
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    if(_failed || _retry) {
+      return -EIO;
+    }
+  }
+
+  BSONObjBuilder file;
+  file << "chunkSize" << chunk_size
+       << "length" << length;
+  file.appendDate("uploadDate", Date_t(mongo_time()));
+  // Hashed locally as the data came in, so mongod doesn't have to read
+  // every chunk back for filemd5. An edit to an existing file may not
+  // have the chunks or the saved hash it would need.
+  string md5 = _lgf.md5();
+  if(md5.empty()) {
+    md5 = storage->fileMD5(_id);
+    if(md5.empty()) {
+      return -EIO;
+    }
+  }
+  file << "md5" << md5;
+
+  // Lets the next edit of the file carry on hashing where this left off
+  md5_state_t state;
+  if(_lgf.md5State(state)) {
+    file << "md5state" << encode_md5_state(state, md5);
+  }
+
+  int res = stored() ? storeEdit(file.obj()) : storeNew(file.obj());
+  if(res) {
+    return res;
+  }
+
+  // From here on flushes only update the chunks and fields that change
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _stored = true;
+  }
+  _lgf.flushed();
+  return 0;
+}
+
+// The first flush of a file written from scratch. Called with _lock
+// held.
+int GridFileWriter::storeNew(const BSONObj& fields)
+{
+  BSONObjBuilder file;
+  file << "filename" << _filename;
+  file.appendElements(fields);
+  if(!storage->putFile(_id, file.obj())) {
+    return -EIO;
+  }
+
+  // The new version is complete and, being the newest, is what lookups
+  // by name resolve to. Only now drop the fs.files documents it
+  // replaces; their chunks stay until readers still holding them are
+  // done.
+  vector<BSONObj> old_ids;
+  vector<BSONObj> versions = storage->findVersions(_filename);
+  bool ok = true;
+  for(vector<BSONObj>::iterator i = versions.begin(); i != versions.end(); i++) {
+    if((*i)["_id"].toString(false) == _id["_id"].toString(false)) {
+      continue;
+    } else if(storage->removeFile(*i)) {
+      old_ids.push_back(*i);
+    } else {
+      ok = false;
+    }
+  }
+
+  open_files.invalidate(_filename);
+  if(!ok) {
+    return -EIO;
+  }
+
+  for(vector<BSONObj>::iterator i = old_ids.begin(); i != old_ids.end(); i++) {
+    chunk_gc.collect(*i);
+  }
+  return 0;
+}
+
+// Updates the stored document the dirty chunks were just written under.
+// Its name is left alone, so a rename while the file was open sticks.
+// Called with _lock held.
+int GridFileWriter::storeEdit(const BSONObj& fields)
+{
+  if(!storage->updateFile(_id, fields)) {
+    // Unlinked or replaced while it was being edited. Its chunks stay
+    // until this writer is done with them; the edit has nowhere to go.
+    cerr << "gridfs-fuse: " << _filename << " was removed while it was "
+         << "open for writing, dropping the edit" << endl;
+    return -ESTALE;
+  }
+
+  open_files.invalidate(_filename);
+  return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GRIDFILE_WRITER_H
+#define __GRIDFILE_WRITER_H
+
+#include "local_gridfile.h"
+#include "work_queue.h"
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <mongo/client/dbclient.h>
+
+// A file being written through the mount. Data is buffered in a
+// LocalGridFile under an _id picked at create time. While the file is
+// written sequentially every chunk that fills up is inserted into
+// fs.chunks in the background and its buffer freed, so flush only has
+// to write the tail and the fs.files document. The first out of order
+// write stops that and the file stays buffered; flush then sends every
+// dirty chunk directly from its buffer. Flushing over an existing file
+// never removes it first: the new version goes in under its own _id and
+// the old one's chunks are collected once nothing reads them. Chunk
+// uploads are spread over the upload threads' connections with at most
+// --upload_inflight of them outstanding per file.
+//
+// An existing file opened for writing is instead changed in place under
+// its own _id. Only the chunks a write partially covers are fetched,
+// and a flush upserts only the chunks written to and then sets the
+// length, md5 and uploadDate, so an edit costs about what it changes.
+// The flush fails rather than bring the file back if it was unlinked or
+// replaced meanwhile, and it keeps whatever name the file has by then.
+// Files written from scratch take this path too once their first flush
+// has stored them.
+class GridFileWriter {
+public:
+  GridFileWriter(const std::string& filename,
+                 int chunkSize = DEFAULT_CHUNK_SIZE);
+  // Edits the stored fs.files document file
+  GridFileWriter(const mongo::BSONObj& file);
+  ~GridFileWriter();
+
+  const std::string& filename() const { return _filename; }
+  off_t getLength();
+
+  // Each of these holds the file's lock, so different files can be
+  // written in parallel while calls on the same file are serialized
+  int write(const char* buf, size_t nbyte, off_t offset);
+  // Writes at whatever the end of the file is by then
+  int append(const char* buf, size_t nbyte);
+  int read(char* buf, size_t size, off_t offset);
+
+  // Returns 0 or a negative errno
+  int flush();
+
+  // Whether fs.files has a document for the file yet, which it doesn't
+  // for a new file until its first flush
+  bool stored();
+  // Whether the writer reads or writes the chunks of the file with
+  // chunk cache key cacheId
+  bool usesFile(const std::string& cacheId);
+
+private:
+  void dispatch(const WorkQueue::Job& job);
+  bool send(int n, const char* data, int len);
+  void upload(int n, ChunkBuffer chunk, int len);
+  void uploadBuffered(int n, const char* data, int len);
+  void uploaded();
+  void waitForUploads();
+  int writeAt(const char* buf, size_t nbyte, off_t offset);
+  bool loadChunks(off_t offset, size_t nbyte);
+  bool loadChunk(int n);
+  int readRemote(char* buf, size_t size, off_t offset);
+  int storeNew(const mongo::BSONObj& fields);
+  int storeEdit(const mongo::BSONObj& fields);
+
+  std::string _filename;
+  LocalGridFile _lgf;
+  boost::mutex _lock;
+  // { _id: ... }
+  mongo::BSONObj _id;
+
+  // Guards the upload bookkeeping below
+  boost::mutex _mutex;
+  bool _stored;
+  boost::condition_variable _cond;
+  int _pending;
+  bool _failed;
+  bool _retry;
+};
+
+typedef boost::shared_ptr<GridFileWriter> WriterPtr;
+
+extern WorkQueue upload_queue;
+
+#endif
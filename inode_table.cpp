@@ -0,0 +1,118 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "inode_table.h"
+#include "lowlevel.h"
+
+using namespace std;
+
+InodeTable inodes;
+
+InodeTable::InodeTable() : _next(FUSE_ROOT_ID + 1)
+{
+  // Never forgotten, so its count just has to stay above zero
+  Node root;
+  root.nlookup = 1;
+  _nodes[FUSE_ROOT_ID] = root;
+  _byPath[""] = FUSE_ROOT_ID;
+}
+
+InodeTable::Ino InodeTable::lookup(const string& path)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+
+  map<string, Ino>::iterator i = _byPath.find(path);
+  if(i != _byPath.end()) {
+    _nodes[i->second].nlookup++;
+    return i->second;
+  }
+
+  Ino ino = _next++;
+  Node& node = _nodes[ino];
+  node.path = path;
+  node.nlookup = 1;
+  _byPath[path] = ino;
+  return ino;
+}
+
+void InodeTable::forget(Ino ino, unsigned long nlookup)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+
+  map<Ino, Node>::iterator i = _nodes.find(ino);
+  if(i == _nodes.end() || ino == FUSE_ROOT_ID) {
+    return;
+  }
+
+  if(i->second.nlookup > nlookup) {
+    i->second.nlookup -= nlookup;
+    return;
+  }
+
+  map<string, Ino>::iterator p = _byPath.find(i->second.path);
+  if(p != _byPath.end() && p->second == ino) {
+    _byPath.erase(p);
+  }
+  _nodes.erase(i);
+}
+
+bool InodeTable::path(Ino ino, string& path)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+
+  map<Ino, Node>::iterator i = _nodes.find(ino);
+  if(i == _nodes.end()) {
+    return false;
+  }
+  path = i->second.path;
+  return true;
+}
+
+bool InodeTable::childPath(Ino parent, const char* name, string& path)
+{
+  if(!this->path(parent, path)) {
+    return false;
+  }
+  if(!path.empty()) {
+    path += '/';
+  }
+  path += name;
+  return true;
+}
+
+void InodeTable::unlink(const string& path)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _byPath.erase(path);
+}
+
+void InodeTable::rename(const string& oldPath, const string& newPath)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+
+  _byPath.erase(newPath);
+
+  map<string, Ino>::iterator i = _byPath.find(oldPath);
+  if(i == _byPath.end()) {
+    return;
+  }
+
+  Ino ino = i->second;
+  _byPath.erase(i);
+  _byPath[newPath] = ino;
+  _nodes[ino].path = newPath;
+}
@@ -0,0 +1,63 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INODE_TABLE_H
+#define __INODE_TABLE_H
+
+#include <map>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+// Node ids handed to the kernel by the low level backend. Each maps to
+// the path it was looked up under and counts the lookups the kernel
+// hasn't forgotten yet; a node goes away once that count drops to zero.
+// The root is always FUSE_ROOT_ID with path "".
+class InodeTable {
+public:
+  typedef unsigned long Ino;
+
+  InodeTable();
+
+  // Returns path's node, creating it if needed, and counts a lookup
+  Ino lookup(const std::string& path);
+  void forget(Ino ino, unsigned long nlookup);
+
+  // False if the kernel asked about a node it had already forgotten
+  bool path(Ino ino, std::string& path);
+  // path of the child name of parent
+  bool childPath(Ino parent, const char* name, std::string& path);
+
+  // path was removed; nodes for it stay valid until forgotten
+  void unlink(const std::string& path);
+  void rename(const std::string& oldPath, const std::string& newPath);
+
+private:
+  struct Node {
+    std::string path;
+    unsigned long nlookup;
+  };
+
+  boost::mutex _mutex;
+  std::map<Ino, Node> _nodes;
+  std::map<std::string, Ino> _byPath;
+  Ino _next;
+};
+
+extern InodeTable inodes;
+
+#endif
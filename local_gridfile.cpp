@@ -1,22 +1,87 @@
 #include "local_gridfile.h"
+#include "chunk_pool.h"
 
 #include <algorithm>
 
+#include <mongo/util/md5.hpp>
+
 using namespace std;
+using namespace mongo;
+
+LocalGridFile::LocalGridFile(int chunkSize, off_t length,
+                             const md5_state_t* md5State) :
+    _chunkSize(chunkSize), _length(length), _dirty(false),
+    _sequential(true), _md5From(-1)
+{
+    int chunks = max<off_t>(1, (length + chunkSize - 1) / chunkSize);
+    _chunks.resize(chunks);
+    _dirtyChunks.resize(chunks, false);
+    _released = length / chunkSize;
+
+    // Copied bytewise since it may point into a BSON buffer
+    if(md5State) {
+        md5_state_t state;
+        memcpy(&state, md5State, sizeof(state));
+        _md5From = _released;
+        _md5States.push_back(state);
+    }
+
+    // An empty file has nothing stored to stand in for
+    if(!length) {
+        _chunks[0] = allocChunk();
+    }
+}
+
+bool LocalGridFile::covers(int n, off_t offset, size_t nbyte)
+{
+    off_t chunk_start = (off_t)n * _chunkSize;
+    return chunk_start >= offset &&
+        chunk_start + _chunkSize <= (off_t)(offset + nbyte);
+}
 
 int LocalGridFile::write(const char *buf, size_t nbyte, off_t offset)
 {
-    int last_chunk = (offset + nbyte) / _chunkSize;
+    if(!nbyte) {
+        return 0;
+    }
+
+    int last_chunk = (offset + nbyte - 1) / _chunkSize;
     int written = 0;
 
-    while(last_chunk > _chunks.size() - 1) {
-        char *new_buf = new char[_chunkSize];
-        memset(new_buf, 0, _chunkSize);
-        _chunks.push_back(new_buf);
+    if(offset != _length) {
+        _sequential = false;
+    }
+
+    while(last_chunk > (int)_chunks.size() - 1) {
+        _chunks.push_back(allocChunk(!covers(_chunks.size(), offset, nbyte)));
+        _dirtyChunks.push_back(true);
     }
 
+    // Remote chunks the write replaces outright are never loaded
     int chunk_num = offset / _chunkSize;
-    char* dest_buf = _chunks[chunk_num];
+    for(int i = chunk_num; i <= last_chunk; i++) {
+        if(!_chunks[i].data) {
+            _chunks[i] = allocChunk(!covers(i, offset, nbyte));
+        }
+        _dirtyChunks[i] = true;
+    }
+
+    // Writing past the end pads a partial last chunk out with zeros
+    int first_changed = chunk_num;
+    if(offset > _length && _length % _chunkSize) {
+        first_changed = min<int>(first_changed, _length / _chunkSize);
+        _dirtyChunks[first_changed] = true;
+    }
+
+    if(first_changed < _md5From) {
+        _md5From = -1;
+        _md5States.clear();
+    } else if(_md5From >= 0 &&
+              first_changed - _md5From + 1 < (int)_md5States.size()) {
+        _md5States.resize(first_changed - _md5From + 1);
+    }
+
+    char* dest_buf = _chunks[chunk_num].data;
 
     int buf_offset = offset % _chunkSize;
     if(buf_offset) {
@@ -29,17 +94,22 @@ int LocalGridFile::write(const char *buf, size_t nbyte, off_t offset)
     }
 
     while(written < nbyte) {
-        dest_buf = _chunks[chunk_num];
+        dest_buf = _chunks[chunk_num].data;
         int to_write = min<size_t>(nbyte - written,
                            (long unsigned int)_chunkSize);
-        memcpy(dest_buf, buf, to_write);
+        memcpy(dest_buf, buf + written, to_write);
         written += to_write;
         chunk_num++;
     }
 
-    _length = max(_length, (int)offset + written);
+    _length = max<off_t>(_length, offset + written);
     _dirty = true;
 
+    // Sealed chunks may be released as soon as this returns
+    if(_sequential) {
+        hashChunks(_length / _chunkSize);
+    }
+
     return written;
 }
 
@@ -48,8 +118,13 @@ int LocalGridFile::read(char* buf, size_t size, off_t offset)
     size_t len = 0;
     int chunk_num = offset / _chunkSize;
 
+    if(offset >= _length) {
+        return 0;
+    }
+    size = min<size_t>(size, _length - offset);
+
     while(len < size && chunk_num < _chunks.size()) {
-        const char* chunk = _chunks[chunk_num];
+        const char* chunk = _chunks[chunk_num].data;
         size_t to_read = min<size_t>((size_t)_chunkSize, size - len);
 
         if(!len && offset) {
@@ -65,3 +140,93 @@ int LocalGridFile::read(char* buf, size_t size, off_t offset)
 
     return len;
 }
+
+bool LocalGridFile::hashChunks(int upTo)
+{
+    if(_md5From < 0) {
+        return false;
+    }
+
+    while(_md5From + (int)_md5States.size() - 1 < upTo) {
+        int n = _md5From + _md5States.size() - 1;
+        if(!_chunks[n].data) {
+            return false;
+        }
+
+        md5_state_t state = _md5States.back();
+        md5_append(&state, (const md5_byte_t*)_chunks[n].data, _chunkSize);
+        _md5States.push_back(state);
+    }
+    return true;
+}
+
+bool LocalGridFile::md5State(md5_state_t& state)
+{
+    int full = _length / _chunkSize;
+    if(!hashChunks(full) || (_length % _chunkSize && !_chunks[full].data)) {
+        return false;
+    }
+
+    state = _md5States.back();
+    return true;
+}
+
+string LocalGridFile::md5()
+{
+    md5_state_t state;
+    if(!md5State(state)) {
+        return "";
+    }
+
+    int full = _length / _chunkSize;
+    int tail = _length - (off_t)full * _chunkSize;
+    if(tail) {
+        md5_append(&state, (const md5_byte_t*)_chunks[full].data, tail);
+    }
+
+    md5digest digest;
+    md5_finish(&state, digest);
+    return digestToString(digest);
+}
+
+ChunkBuffer LocalGridFile::releaseChunk()
+{
+    ChunkBuffer chunk = _chunks[_released];
+    _chunks[_released] = ChunkBuffer();
+    // Its upload is on the caller now
+    _dirtyChunks[_released] = false;
+    _released++;
+    return chunk;
+}
+
+void LocalGridFile::loadChunk(int n, const char* data, int len)
+{
+    ChunkBuffer chunk = allocChunk(len < _chunkSize);
+    memcpy(chunk.data, data, min(len, _chunkSize));
+
+    _chunks[n] = chunk;
+    _dirtyChunks[n] = false;
+}
+
+ChunkBuffer LocalGridFile::allocChunk(bool zero)
+{
+    ChunkBuffer chunk;
+
+    if(!write_memory.reserve(_chunkSize)) {
+        if(!_spill) {
+            _spill.reset(new SpillFile(_chunkSize));
+        }
+
+        chunk.data = _spill->mapChunk();
+        if(chunk.data) {
+            chunk.spill = _spill;
+            return chunk;
+        }
+
+        // Nowhere to spill to, go over budget rather than fail the write
+        write_memory.charge(_chunkSize);
+    }
+
+    chunk.data = chunk_pool.allocate(_chunkSize, zero);
+    return chunk;
+}
@@ -1,40 +1,117 @@
 #ifndef _LOCAL_GRIDFILE_H
 #define _LOCAL_GRIDFILE_H
 
+#include "spill.h"
 #include <vector>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <sys/types.h>
+
+#include <mongo/util/md5.h>
 
 const unsigned int DEFAULT_CHUNK_SIZE = 256 * 1024;
 
 class LocalGridFile {
 public:
   LocalGridFile(int chunkSize = DEFAULT_CHUNK_SIZE) :
-  _chunkSize(chunkSize), _length(0), _dirty(true) {
-      _chunks.push_back(new char[_chunkSize]);
+  _chunkSize(chunkSize), _length(0), _dirty(true), _sequential(true),
+  _released(0), _md5From(0) {
+      _chunks.push_back(allocChunk());
+      _dirtyChunks.push_back(true);
+
+      md5_state_t start;
+      md5_init(&start);
+      _md5States.push_back(start);
     }
 
+  // Stands in for length bytes that are already stored. Every chunk
+  // starts out remote, to be loaded only if a write needs what's in it;
+  // the full ones count as released. md5State is the hash of those full
+  // chunks, if it's known.
+  LocalGridFile(int chunkSize, off_t length, const md5_state_t* md5State);
+
   ~LocalGridFile() {
-    for(std::vector<char*>::iterator i = _chunks.begin();
+    for(std::vector<ChunkBuffer>::iterator i = _chunks.begin();
       i != _chunks.end(); i++) {
-      delete *i;
+      free_chunk(*i, _chunkSize);
     }
   }
 
   int getChunkSize() { return _chunkSize; }
   int getNumChunks() { return _chunks.size(); }
-  int getLength() { return _length; }
-  char* getChunk(int n) { return _chunks[n]; }
+  off_t getLength() { return _length; }
+  char* getChunk(int n) { return _chunks[n].data; }
+  // False for chunks that are only stored remotely, released or never
+  // loaded
+  bool isLocal(int n) { return _chunks[n].data != NULL; }
   bool dirty() { return _dirty; }
-  void flushed() { _dirty = false; }
+  // Whether chunk n changed since the last flush
+  bool dirty(int n) { return _dirtyChunks[n]; }
+  void flushed() {
+    _dirty = false;
+    _dirtyChunks.assign(_dirtyChunks.size(), false);
+  }
+
+  // True as long as every write has started where the last one ended
+  bool sequential() { return _sequential; }
+
+  // Leading chunks that are full and, while writes stay sequential, will
+  // never change again
+  int getSealedChunks() { return _sequential ? _length / _chunkSize : 0; }
+
+  // Chunks before this have been handed off with releaseChunk()
+  int getReleasedChunks() { return _released; }
 
+  // Gives up ownership of the next sealed chunk's buffer. The caller
+  // frees it with free_chunk().
+  ChunkBuffer releaseChunk();
+
+  // Fills in remote chunk n with what's stored for it. It comes back
+  // clean since it matches what was uploaded.
+  void loadChunk(int n, const char* data, int len);
+
+  // A write must only partially cover chunks that are local, or that
+  // it will grow past the end of the stored data. Reads must only
+  // touch local chunks.
   int write(const char* buf, size_t nbyte, off_t offset);
   int read(char* buf, size_t size, off_t offset);
 
+  // Hex MD5 of the contents, as GridFS stores it in fs.files. Chunks
+  // are hashed as they're sealed so this usually only has to add the
+  // tail; a write behind what was hashed rewinds to the checkpoint
+  // before the chunk it touched. Empty if that needs a chunk that
+  // isn't local, or a checkpoint from before a file's stored state.
+  std::string md5();
+  // The hash of every full chunk, to pick up from when the file is
+  // next opened. False if md5() couldn't be computed.
+  bool md5State(md5_state_t& state);
+
 private:
-  int _chunkSize, _length;
+  // Whether writing nbyte at offset overwrites all of chunk n
+  bool covers(int n, off_t offset, size_t nbyte);
+
+  // Extends the hash over every full chunk before upTo. False if a
+  // chunk it needs isn't local.
+  bool hashChunks(int upTo);
+
+  // Pooled heap memory while the mount's write budget allows, a chunk
+  // mapped from this file's spill file after that. Only pass zero = false
+  // if the whole chunk is about to be overwritten.
+  ChunkBuffer allocChunk(bool zero = true);
+
+  int _chunkSize;
+  off_t _length;
   bool _dirty;
-  std::vector<char*> _chunks;
+  bool _sequential;
+  int _released;
+  std::vector<ChunkBuffer> _chunks;
+  std::vector<bool> _dirtyChunks;
+  // MD5 state after hashing the first _md5From + i chunks, for each i
+  // hashed so far. _md5From is -1 once no checkpoint is left.
+  int _md5From;
+  std::vector<md5_state_t> _md5States;
+  boost::shared_ptr<SpillFile> _spill;
 };
 
 #endif
@@ -0,0 +1,520 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lowlevel.h"
+#include "inode_table.h"
+#include "file_handle.h"
+#include "options.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/thread/tss.hpp>
+
+using namespace std;
+
+static inline FileHandle* get_handle(struct fuse_file_info* fi)
+{
+  return (FileHandle*)(uintptr_t)fi->fh;
+}
+
+// Scratch space for building replies, one per FUSE worker thread. It
+// only ever grows and is never cleared, so a read doesn't allocate or
+// zero a buffer of its own.
+static boost::thread_specific_ptr<vector<char> > reply_buffers;
+
+static char* reply_buffer(size_t size)
+{
+  vector<char>* buf = reply_buffers.get();
+  if(!buf) {
+    buf = new vector<char>;
+    reply_buffers.reset(buf);
+  }
+
+  if(buf->size() < size) {
+    buf->resize(size);
+  }
+  return size ? &(*buf)[0] : NULL;
+}
+
+// The path based handlers want FUSE's absolute paths
+static inline string fuse_path(const string& path)
+{
+  return "/" + path;
+}
+
+static bool node_path(fuse_req_t req, fuse_ino_t ino, string& path)
+{
+  if(!inodes.path(ino, path)) {
+    fuse_reply_err(req, ESTALE);
+    return false;
+  }
+  return true;
+}
+
+static bool child_path(fuse_req_t req, fuse_ino_t parent, const char* name,
+                       string& path)
+{
+  if(!inodes.childPath(parent, name, path)) {
+    fuse_reply_err(req, ESTALE);
+    return false;
+  }
+  return true;
+}
+
+// Counts a lookup of path and fills in the rest of e. The count only
+// stands if the kernel actually got the reply.
+static fuse_ino_t add_entry(const string& path, struct fuse_entry_param& e)
+{
+  e.ino = inodes.lookup(path);
+  e.generation = 0;
+  e.attr.st_ino = e.ino;
+  e.attr_timeout = gridfs_options.attr_timeout;
+  e.entry_timeout = gridfs_options.attr_timeout;
+  return e.ino;
+}
+
+static void ll_init(void* userdata, struct fuse_conn_info* conn)
+{
+  gridfs_init(conn);
+}
+
+static void ll_destroy(void* userdata)
+{
+  gridfs_destroy(userdata);
+}
+
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
+{
+  string path;
+  if(!child_path(req, parent, name, path)) {
+    return;
+  }
+
+  struct fuse_entry_param e;
+  memset(&e, 0, sizeof(e));
+
+  int res = gridfs_getattr(fuse_path(path).c_str(), &e.attr);
+  if(res == -ENOENT) {
+    // A zero ino is a negative entry the kernel can cache
+    e.entry_timeout = gridfs_options.negative_timeout;
+    fuse_reply_entry(req, &e);
+    return;
+  } else if(res) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  fuse_ino_t ino = add_entry(path, e);
+  if(fuse_reply_entry(req, &e) != 0) {
+    inodes.forget(ino, 1);
+  }
+}
+
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+  inodes.forget(ino, nlookup);
+  fuse_reply_none(req);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino,
+                       struct fuse_file_info* fi)
+{
+  string path;
+  if(!node_path(req, ino, path)) {
+    return;
+  }
+
+  struct stat st;
+  int res = gridfs_getattr(fuse_path(path).c_str(), &st);
+  if(res) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  st.st_ino = ino;
+  fuse_reply_attr(req, &st, gridfs_options.attr_timeout);
+}
+
+// Only a change of size is understood, and that fails like truncate
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr,
+                       int to_set, struct fuse_file_info* fi)
+{
+  string path;
+  if(!node_path(req, ino, path)) {
+    return;
+  }
+
+  if(to_set & FUSE_SET_ATTR_SIZE) {
+    fuse_reply_err(req, -gridfs_truncate(fuse_path(path).c_str(),
+                                         attr->st_size));
+  } else {
+    fuse_reply_err(req, ENOSYS);
+  }
+}
+
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+  string path;
+  if(!node_path(req, ino, path)) {
+    return;
+  }
+
+  int res = gridfs_open(fuse_path(path).c_str(), fi);
+  if(res) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  // Interrupted, so no release will ever come for this handle
+  if(fuse_reply_open(req, fi) != 0) {
+    gridfs_release_handle(get_handle(fi));
+  }
+}
+
+static void ll_create(fuse_req_t req, fuse_ino_t parent, const char* name,
+                      mode_t mode, struct fuse_file_info* fi)
+{
+  string path;
+  if(!child_path(req, parent, name, path)) {
+    return;
+  }
+
+  int res = gridfs_create(fuse_path(path).c_str(), mode, fi);
+  if(res) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  struct fuse_entry_param e;
+  memset(&e, 0, sizeof(e));
+  gridfs_getattr(fuse_path(path).c_str(), &e.attr);
+
+  fuse_ino_t ino = add_entry(path, e);
+  if(fuse_reply_create(req, &e, fi) != 0) {
+    gridfs_release_handle(get_handle(fi));
+    inodes.forget(ino, 1);
+  }
+}
+
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                    struct fuse_file_info* fi)
+{
+  char* buf = reply_buffer(size);
+  int res = size ? gridfs_read_handle(get_handle(fi), buf, size, off) : 0;
+  if(res < 0) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  fuse_reply_buf(req, res ? buf : NULL, res);
+}
+
+static void ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf,
+                     size_t size, off_t off, struct fuse_file_info* fi)
+{
+  int res = gridfs_write_handle(get_handle(fi), buf, size, off);
+  if(res < 0) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  fuse_reply_write(req, res);
+}
+
+static void ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+  fuse_reply_err(req, -gridfs_flush_handle(get_handle(fi)));
+}
+
+static void ll_release(fuse_req_t req, fuse_ino_t ino,
+                       struct fuse_file_info* fi)
+{
+  gridfs_release_handle(get_handle(fi));
+  fuse_reply_err(req, 0);
+}
+
+namespace {
+  // A directory listing built once at opendir and handed out in
+  // whatever slices readdir asks for
+  struct DirBuffer {
+    fuse_req_t req;
+    string data;
+  };
+}
+
+static int fill_dir(void* buf, const char* name, const struct stat* st,
+                    off_t off)
+{
+  DirBuffer* dir = (DirBuffer*)buf;
+
+  // A high level filler may be passed a NULL stat, but
+  // fuse_add_direntry reads the entry's type from it
+  struct stat dir_st;
+  if(!st) {
+    memset(&dir_st, 0, sizeof(dir_st));
+    dir_st.st_mode = S_IFDIR;
+    st = &dir_st;
+  }
+
+  size_t len = fuse_add_direntry(dir->req, NULL, 0, name, NULL, 0);
+  size_t start = dir->data.size();
+  dir->data.resize(start + len);
+  fuse_add_direntry(dir->req, &dir->data[start], len, name, st,
+                    dir->data.size());
+  return 0;
+}
+
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino,
+                       struct fuse_file_info* fi)
+{
+  string path;
+  if(!node_path(req, ino, path)) {
+    return;
+  }
+
+  DirBuffer* dir = new DirBuffer;
+  dir->req = req;
+
+  int res = gridfs_readdir(fuse_path(path).c_str(), dir, fill_dir, 0, fi);
+  if(res) {
+    delete dir;
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  fi->fh = (uintptr_t)dir;
+  if(fuse_reply_open(req, fi) != 0) {
+    delete dir;
+  }
+}
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+                       off_t off, struct fuse_file_info* fi)
+{
+  DirBuffer* dir = (DirBuffer*)(uintptr_t)fi->fh;
+
+  if(off < (off_t)dir->data.size()) {
+    fuse_reply_buf(req, dir->data.data() + off,
+                   min(size, dir->data.size() - off));
+  } else {
+    fuse_reply_buf(req, NULL, 0);
+  }
+}
+
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino,
+                          struct fuse_file_info* fi)
+{
+  delete (DirBuffer*)(uintptr_t)fi->fh;
+  fuse_reply_err(req, 0);
+}
+
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name)
+{
+  string path;
+  if(!child_path(req, parent, name, path)) {
+    return;
+  }
+
+  int res = gridfs_unlink(fuse_path(path).c_str());
+  if(!res) {
+    inodes.unlink(path);
+  }
+  fuse_reply_err(req, -res);
+}
+
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name,
+                     mode_t mode)
+{
+  string path;
+  if(!child_path(req, parent, name, path)) {
+    return;
+  }
+
+  struct fuse_entry_param e;
+  memset(&e, 0, sizeof(e));
+
+  int res = gridfs_mkdir(fuse_path(path).c_str(), mode);
+  if(!res) {
+    res = gridfs_getattr(fuse_path(path).c_str(), &e.attr);
+  }
+  if(res) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  fuse_ino_t ino = add_entry(path, e);
+  if(fuse_reply_entry(req, &e) != 0) {
+    inodes.forget(ino, 1);
+  }
+}
+
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name)
+{
+  string path;
+  if(!child_path(req, parent, name, path)) {
+    return;
+  }
+
+  int res = gridfs_rmdir(fuse_path(path).c_str());
+  if(!res) {
+    inodes.unlink(path);
+  }
+  fuse_reply_err(req, -res);
+}
+
+static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char* name,
+                      fuse_ino_t newparent, const char* newname)
+{
+  string old_path, new_path;
+  if(!child_path(req, parent, name, old_path) ||
+     !child_path(req, newparent, newname, new_path)) {
+    return;
+  }
+
+  int res = gridfs_rename(fuse_path(old_path).c_str(),
+                          fuse_path(new_path).c_str());
+  if(!res) {
+    inodes.rename(old_path, new_path);
+  }
+  fuse_reply_err(req, -res);
+}
+
+static void ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char* name,
+                        const char* value, size_t size, int flags)
+{
+  string path;
+  if(!node_path(req, ino, path)) {
+    return;
+  }
+
+  fuse_reply_err(req, -gridfs_setxattr(fuse_path(path).c_str(), name,
+                                       value, size, flags));
+}
+
+static void ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char* name)
+{
+  string path;
+  if(!node_path(req, ino, path)) {
+    return;
+  }
+
+  fuse_reply_err(req, -gridfs_removexattr(fuse_path(path).c_str(), name));
+}
+
+// getxattr and listxattr reply with just the size when asked for it
+static void reply_xattr(fuse_req_t req, int res, const char* buf)
+{
+  if(res < 0) {
+    fuse_reply_err(req, -res);
+  } else if(!buf) {
+    fuse_reply_xattr(req, res);
+  } else {
+    fuse_reply_buf(req, buf, res);
+  }
+}
+
+static void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char* name,
+                        size_t size)
+{
+  string path;
+  if(!node_path(req, ino, path)) {
+    return;
+  }
+
+  char* buf = reply_buffer(size);
+  int res = gridfs_getxattr(fuse_path(path).c_str(), name, buf, size);
+  reply_xattr(req, res, buf);
+}
+
+static void ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+  string path;
+  if(!node_path(req, ino, path)) {
+    return;
+  }
+
+  char* buf = reply_buffer(size);
+  int res = gridfs_listxattr(fuse_path(path).c_str(), buf, size);
+  reply_xattr(req, res, buf);
+}
+
+int lowlevel_main(struct fuse_args* args)
+{
+  static struct fuse_lowlevel_ops gridfs_ll_oper;
+  gridfs_ll_oper.init = ll_init;
+  gridfs_ll_oper.destroy = ll_destroy;
+  gridfs_ll_oper.lookup = ll_lookup;
+  gridfs_ll_oper.forget = ll_forget;
+  gridfs_ll_oper.getattr = ll_getattr;
+  gridfs_ll_oper.setattr = ll_setattr;
+  gridfs_ll_oper.open = ll_open;
+  gridfs_ll_oper.create = ll_create;
+  gridfs_ll_oper.read = ll_read;
+  gridfs_ll_oper.write = ll_write;
+  gridfs_ll_oper.flush = ll_flush;
+  gridfs_ll_oper.release = ll_release;
+  gridfs_ll_oper.opendir = ll_opendir;
+  gridfs_ll_oper.readdir = ll_readdir;
+  gridfs_ll_oper.releasedir = ll_releasedir;
+  gridfs_ll_oper.unlink = ll_unlink;
+  gridfs_ll_oper.mkdir = ll_mkdir;
+  gridfs_ll_oper.rmdir = ll_rmdir;
+  gridfs_ll_oper.rename = ll_rename;
+  gridfs_ll_oper.setxattr = ll_setxattr;
+  gridfs_ll_oper.getxattr = ll_getxattr;
+  gridfs_ll_oper.listxattr = ll_listxattr;
+  gridfs_ll_oper.removexattr = ll_removexattr;
+
+  char* mountpoint;
+  int multithreaded;
+  int foreground;
+  if(fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1) {
+    return 1;
+  }
+
+  struct fuse_chan* ch = fuse_mount(mountpoint, args);
+  if(!ch) {
+    free(mountpoint);
+    return 1;
+  }
+
+  int err = -1;
+  struct fuse_session* se = fuse_lowlevel_new(args, &gridfs_ll_oper,
+                                              sizeof(gridfs_ll_oper), NULL);
+  if(se) {
+    if(fuse_set_signal_handlers(se) != -1) {
+      fuse_session_add_chan(se, ch);
+      if(fuse_daemonize(foreground) != -1) {
+        err = multithreaded ? fuse_session_loop_mt(se)
+                            : fuse_session_loop(se);
+      }
+      fuse_remove_signal_handlers(se);
+      fuse_session_remove_chan(ch);
+    }
+    fuse_session_destroy(se);
+  }
+
+  fuse_unmount(mountpoint, ch);
+  free(mountpoint);
+
+  return err ? 1 : 0;
+}
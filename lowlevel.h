@@ -0,0 +1,32 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOWLEVEL_H
+#define __LOWLEVEL_H
+
+#include "operations.h"
+
+#include <fuse_lowlevel.h>
+
+// Mounts through the FUSE low level API instead of fuse_main. The
+// kernel talks in node ids from the inode table, so reads, writes and
+// flushes go straight to the FileHandle in fuse_file_info::fh without
+// FUSE rebuilding a path for every call. Calls that do need a name
+// reuse the path based handlers.
+int lowlevel_main(struct fuse_args* args);
+
+#endif
@@ -16,32 +16,65 @@
  */
 
 #include "operations.h"
+#include "lowlevel.h"
 #include "options.h"
 #include "utils.h"
+#include "chunk_cache.h"
+#include "disk_cache.h"
+#include "stat_cache.h"
+#include "spill.h"
+#include "chunk_pool.h"
+#include "storage.h"
+#include "connection_pool.h"
+#include "snapshot_storage.h"
 #include <cstring>
+#include <cstdio>
 
 using namespace std;
 
+static const unsigned NO_TIMEOUT = (unsigned)-1;
+
 int main(int argc, char *argv[])
 {
   static struct fuse_operations gridfs_oper;
+  gridfs_oper.init = gridfs_init;
+  gridfs_oper.destroy = gridfs_destroy;
   gridfs_oper.getattr = gridfs_getattr;
   gridfs_oper.readdir = gridfs_readdir;
   gridfs_oper.open = gridfs_open;
   gridfs_oper.create = gridfs_create;
   gridfs_oper.release = gridfs_release;
   gridfs_oper.unlink = gridfs_unlink;
+  gridfs_oper.mkdir = gridfs_mkdir;
+  gridfs_oper.rmdir = gridfs_rmdir;
   gridfs_oper.read = gridfs_read;
   gridfs_oper.listxattr = gridfs_listxattr;
   gridfs_oper.getxattr = gridfs_getxattr;
   gridfs_oper.setxattr = gridfs_setxattr;
+  gridfs_oper.removexattr = gridfs_removexattr;
   gridfs_oper.write = gridfs_write;
   gridfs_oper.flush = gridfs_flush;
   gridfs_oper.rename = gridfs_rename;
+  gridfs_oper.truncate = gridfs_truncate;
 
   struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
   memset(&gridfs_options, 0, sizeof(struct gridfs_options));
+  gridfs_options.cache_size = 64;
+  gridfs_options.readahead = 8;
+  gridfs_options.readahead_threads = 4;
+  // Defaults depend on --readonly
+  gridfs_options.attr_timeout = NO_TIMEOUT;
+  gridfs_options.negative_timeout = NO_TIMEOUT;
+  gridfs_options.upload_threads = 4;
+  gridfs_options.upload_inflight = 8;
+  gridfs_options.buffer_pool = 16;
+  gridfs_options.disk_cache_size = 1024;
+  gridfs_options.pool_size = 8;
+  gridfs_options.health_check = 60;
+  gridfs_options.reconnect_tries = 3;
+  gridfs_options.reconnect_delay = 100;
+
   if(fuse_opt_parse(&args, &gridfs_options, gridfs_opts,
             gridfs_opt_proc) == -1)
   {
@@ -54,6 +87,68 @@ int main(int argc, char *argv[])
   if(!gridfs_options.db) {
     gridfs_options.db = "test";
   }
+  if(!gridfs_options.backend) {
+    gridfs_options.backend = "mongo";
+  }
+
+  // Nothing changes under a snapshot until it's next polled, so the
+  // kernel may as well keep what it's been told until then
+  unsigned default_timeout = 1;
+  if(gridfs_options.readonly) {
+    default_timeout = gridfs_options.poll ? gridfs_options.poll : 24 * 60 * 60;
+  }
+  if(gridfs_options.attr_timeout == NO_TIMEOUT) {
+    gridfs_options.attr_timeout = default_timeout;
+  }
+  if(gridfs_options.negative_timeout == NO_TIMEOUT) {
+    gridfs_options.negative_timeout = default_timeout;
+  }
+
+  storage = make_storage(gridfs_options.backend);
+  if(!storage) {
+    fprintf(stderr, "mount_gridfs: unknown backend %s\n",
+            gridfs_options.backend);
+    return -1;
+  }
+  if(gridfs_options.readonly) {
+    storage = snapshot = new SnapshotStorage(storage, gridfs_options.poll);
+    fuse_opt_add_arg(&args, "-oro");
+  }
+
+  connections.configure(gridfs_options.host, gridfs_options.pool_size,
+                        gridfs_options.health_check,
+                        gridfs_options.reconnect_tries,
+                        gridfs_options.reconnect_delay);
+  chunk_cache.setCapacity((size_t)gridfs_options.cache_size * 1024 * 1024);
+  if(gridfs_options.disk_cache &&
+     !disk_cache.open(gridfs_options.disk_cache,
+                      (size_t)gridfs_options.disk_cache_size * 1024 * 1024)) {
+    fprintf(stderr, "mount_gridfs: can't use %s for the disk cache\n",
+            gridfs_options.disk_cache);
+    return -1;
+  }
+  chunk_pool.setMaxCached((size_t)gridfs_options.buffer_pool * 1024 * 1024);
+  write_memory.setLimit((size_t)gridfs_options.write_buffer * 1024 * 1024);
+  if(gridfs_options.spill_dir) {
+    SpillFile::setDirectory(gridfs_options.spill_dir);
+  }
+  stat_cache.setTimeouts(gridfs_options.attr_timeout,
+                         gridfs_options.negative_timeout);
+
+  // The low level backend hands the kernel its timeouts with every
+  // entry instead
+  if(gridfs_options.lowlevel) {
+    return lowlevel_main(&args);
+  }
+
+  // Let the kernel's dentry and attribute caches hold entries for as
+  // long as we do
+  char timeouts[128];
+  snprintf(timeouts, sizeof(timeouts),
+           "-oentry_timeout=%u,attr_timeout=%u,negative_timeout=%u",
+           gridfs_options.attr_timeout, gridfs_options.attr_timeout,
+           gridfs_options.negative_timeout);
+  fuse_opt_add_arg(&args, timeouts);
 
   return fuse_main(args.argc, args.argv, &gridfs_oper, NULL);
 }
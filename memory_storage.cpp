@@ -0,0 +1,317 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memory_storage.h"
+#include "metrics.h"
+#include <cstring>
+#include <unistd.h>
+
+#include <mongo/util/md5.hpp>
+
+using namespace std;
+using namespace mongo;
+
+void MemoryStorage::roundTrip()
+{
+  metrics.add(Metrics::ROUND_TRIPS);
+  if(_latency > 0) {
+    usleep((useconds_t)(_latency * 1e6));
+  }
+}
+
+string MemoryStorage::key(const BSONObj& id)
+{
+  return id["_id"].toString(false);
+}
+
+BSONObj MemoryStorage::newest(const string& filename)
+{
+  BSONObj best;
+  for(set<NameKey>::iterator i = _names.lower_bound(NameKey(filename, ""));
+      i != _names.end() && i->first == filename; i++) {
+    BSONObj& file = _files[i->second];
+    if(best.isEmpty() || file["uploadDate"].date() > best["uploadDate"].date()) {
+      best = file;
+    }
+  }
+  return best;
+}
+
+void MemoryStorage::setFile(const string& key, const BSONObj& file)
+{
+  map<string, BSONObj>::iterator old = _files.find(key);
+  if(old != _files.end()) {
+    _names.erase(NameKey(old->second.getStringField("filename"), key));
+  }
+
+  _files[key] = file.getOwned();
+  _names.insert(NameKey(file.getStringField("filename"), key));
+}
+
+BSONObj MemoryStorage::findFile(const string& filename, const BSONObj* fields)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+  return newest(filename);
+}
+
+void MemoryStorage::listFiles(const string& lower, const string& upper,
+                              const BSONObj* fields, const FileSink& sink,
+                              int limit)
+{
+  roundTrip();
+
+  // Copied out so the sink can run without the lock, like a cursor
+  vector<BSONObj> files;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    for(set<NameKey>::iterator i = _names.lower_bound(NameKey(lower, ""));
+        i != _names.end() && (upper.empty() || i->first < upper) &&
+          (!limit || (int)files.size() < limit); i++) {
+      files.push_back(_files[i->second]);
+    }
+  }
+
+  for(vector<BSONObj>::iterator f = files.begin(); f != files.end(); f++) {
+    if(!sink(*f)) {
+      break;
+    }
+  }
+}
+
+void MemoryStorage::listUpdated(unsigned long long since,
+                                const BSONObj* fields, const FileSink& sink)
+{
+  roundTrip();
+
+  vector<BSONObj> files;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    for(map<string, BSONObj>::iterator i = _files.begin(); i != _files.end(); i++) {
+      if((unsigned long long)i->second["uploadDate"].date() >= since) {
+        files.push_back(i->second);
+      }
+    }
+  }
+
+  for(vector<BSONObj>::iterator f = files.begin(); f != files.end(); f++) {
+    if(!sink(*f)) {
+      break;
+    }
+  }
+}
+
+vector<BSONObj> MemoryStorage::findVersions(const string& filename)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+
+  vector<BSONObj> ids;
+  for(set<NameKey>::iterator i = _names.lower_bound(NameKey(filename, ""));
+      i != _names.end() && i->first == filename; i++) {
+    ids.push_back(BSON("_id" << _files[i->second]["_id"]));
+  }
+  return ids;
+}
+
+bool MemoryStorage::putFile(const BSONObj& id, const BSONObj& fields)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+  mergeFile(id, fields);
+  return true;
+}
+
+bool MemoryStorage::updateFile(const BSONObj& id, const BSONObj& fields)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+
+  if(_files.find(key(id)) == _files.end()) {
+    return false;
+  }
+  mergeFile(id, fields);
+  return true;
+}
+
+// Sets fields on the document id, creating it if needed. Called with
+// _mutex held.
+void MemoryStorage::mergeFile(const BSONObj& id, const BSONObj& fields)
+{
+  string k = key(id);
+  BSONObjBuilder file;
+  file.append(id["_id"]);
+
+  // Like $set: keep whatever fields aren't being replaced
+  map<string, BSONObj>::iterator old = _files.find(k);
+  if(old != _files.end()) {
+    BSONObjIterator i(old->second);
+    while(i.more()) {
+      BSONElement e = i.next();
+      if(strcmp(e.fieldName(), "_id") != 0 && !fields.hasField(e.fieldName())) {
+        file.append(e);
+      }
+    }
+  }
+  file.appendElements(fields);
+
+  setFile(k, file.obj());
+}
+
+bool MemoryStorage::removeFile(const BSONObj& id)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+
+  map<string, BSONObj>::iterator i = _files.find(key(id));
+  if(i != _files.end()) {
+    _names.erase(NameKey(i->second.getStringField("filename"), i->first));
+    _files.erase(i);
+  }
+  return true;
+}
+
+bool MemoryStorage::renameFile(const string& oldName, const string& newName)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+
+  BSONObj file = newest(oldName);
+  if(file.isEmpty()) {
+    return false;
+  }
+
+  BSONObjBuilder b;
+  BSONObjIterator i(file);
+  while(i.more()) {
+    BSONElement e = i.next();
+    if(strcmp(e.fieldName(), "filename") != 0) {
+      b.append(e);
+    }
+  }
+  b << "filename" << newName;
+
+  setFile(key(file), b.obj());
+  return true;
+}
+
+// Rewrites the newest version of filename with metadata.<name> set to
+// value, or removed if value is NULL. Called with _mutex held.
+bool MemoryStorage::updateMetadata(const string& filename, const string& name,
+                                   const string* value)
+{
+  BSONObj file = newest(filename);
+  if(file.isEmpty()) {
+    return false;
+  }
+
+  BSONObjBuilder metadata;
+  BSONObjIterator i(file.getObjectField("metadata"));
+  while(i.more()) {
+    BSONElement e = i.next();
+    if(name != e.fieldName()) {
+      metadata.append(e);
+    }
+  }
+  if(value) {
+    metadata << name << *value;
+  }
+
+  BSONObjBuilder b;
+  BSONObjIterator j(file);
+  while(j.more()) {
+    BSONElement e = j.next();
+    if(strcmp(e.fieldName(), "metadata") != 0) {
+      b.append(e);
+    }
+  }
+  b << "metadata" << metadata.obj();
+
+  setFile(key(file), b.obj());
+  return true;
+}
+
+bool MemoryStorage::setMetadata(const string& filename, const string& name,
+                                const string& value)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+  return updateMetadata(filename, name, &value);
+}
+
+bool MemoryStorage::removeMetadata(const string& filename, const string& name)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+  return updateMetadata(filename, name, NULL);
+}
+
+int MemoryStorage::fetchChunks(const BSONObj& id, int first, int last,
+                               const ChunkDataSink& sink)
+{
+  roundTrip();
+
+  vector<pair<int, string> > chunks;
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    map<int, string>& file = _chunks[key(id)];
+    for(map<int, string>::iterator i = file.lower_bound(first);
+        i != file.end() && i->first < last; i++) {
+      chunks.push_back(*i);
+    }
+  }
+
+  for(vector<pair<int, string> >::iterator i = chunks.begin();
+      i != chunks.end(); i++) {
+    sink(i->first, i->second.data(), i->second.size());
+  }
+  return chunks.size();
+}
+
+bool MemoryStorage::putChunk(const BSONObj& id, int n, const char* data, int len)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+  _chunks[key(id)][n].assign(data, len);
+  return true;
+}
+
+bool MemoryStorage::removeChunks(const BSONObj& id)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+  _chunks.erase(key(id));
+  return true;
+}
+
+string MemoryStorage::fileMD5(const BSONObj& id)
+{
+  roundTrip();
+  boost::mutex::scoped_lock lock(_mutex);
+
+  md5_state_t state;
+  md5_init(&state);
+
+  map<int, string>& chunks = _chunks[key(id)];
+  for(map<int, string>::iterator i = chunks.begin(); i != chunks.end(); i++) {
+    md5_append(&state, (const md5_byte_t*)i->second.data(), i->second.size());
+  }
+
+  md5digest digest;
+  md5_finish(&state, digest);
+  return digestToString(digest);
+}
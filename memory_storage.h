@@ -0,0 +1,78 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MEMORY_STORAGE_H
+#define __MEMORY_STORAGE_H
+
+#include "storage.h"
+#include <map>
+#include <set>
+
+#include <boost/thread/mutex.hpp>
+
+// GridFS held in this process, for measuring the filesystem's own
+// overhead without a mongod. Every call sleeps for latency seconds
+// first to stand in for a round trip. Nothing survives the mount.
+class MemoryStorage : public Storage {
+public:
+  MemoryStorage(double latency = 0) : _latency(latency) {}
+
+  mongo::BSONObj findFile(const std::string& filename,
+                          const mongo::BSONObj* fields = NULL);
+  void listFiles(const std::string& lower, const std::string& upper,
+                 const mongo::BSONObj* fields, const FileSink& sink,
+                 int limit = 0);
+  void listUpdated(unsigned long long since, const mongo::BSONObj* fields,
+                   const FileSink& sink);
+  std::vector<mongo::BSONObj> findVersions(const std::string& filename);
+
+  bool putFile(const mongo::BSONObj& id, const mongo::BSONObj& fields);
+  bool removeFile(const mongo::BSONObj& id);
+  bool updateFile(const mongo::BSONObj& id, const mongo::BSONObj& fields);
+  bool renameFile(const std::string& oldName, const std::string& newName);
+  bool setMetadata(const std::string& filename, const std::string& name,
+                   const std::string& value);
+  bool removeMetadata(const std::string& filename, const std::string& name);
+
+  int fetchChunks(const mongo::BSONObj& id, int first, int last,
+                  const ChunkDataSink& sink);
+  bool putChunk(const mongo::BSONObj& id, int n, const char* data, int len);
+  bool removeChunks(const mongo::BSONObj& id);
+  std::string fileMD5(const mongo::BSONObj& id);
+
+private:
+  typedef std::pair<std::string, std::string> NameKey;
+
+  void roundTrip();
+  static std::string key(const mongo::BSONObj& id);
+  // Newest document named filename. Called with _mutex held.
+  mongo::BSONObj newest(const std::string& filename);
+  void setFile(const std::string& key, const mongo::BSONObj& file);
+  void mergeFile(const mongo::BSONObj& id, const mongo::BSONObj& fields);
+  bool updateMetadata(const std::string& filename, const std::string& name,
+                      const std::string* value);
+
+  double _latency;
+  boost::mutex _mutex;
+  // fs.files documents by _id, and (filename, _id) pairs standing in
+  // for the filename index
+  std::map<std::string, mongo::BSONObj> _files;
+  std::set<NameKey> _names;
+  std::map<std::string, std::map<int, std::string> > _chunks;
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metrics.h"
+#include "chunk_cache.h"
+#include "disk_cache.h"
+#include "snapshot_storage.h"
+#include "chunk_pool.h"
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+Metrics metrics;
+
+static const char* op_names[Metrics::NUM_OPS] = {
+  "getattr", "readdir", "open", "create", "release", "read", "write",
+  "flush", "unlink", "rename", "listxattr", "getxattr", "setxattr",
+  "removexattr", "mkdir", "rmdir"
+};
+
+Metrics::Bucket& Metrics::local()
+{
+  Bucket* bucket = _buckets.get();
+  if(bucket) {
+    return *bucket;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    if(!_free.empty()) {
+      bucket = _free.back();
+      _free.pop_back();
+    } else {
+      bucket = new Bucket;
+      memset(bucket, 0, sizeof(Bucket));
+      _all.push_back(bucket);
+    }
+  }
+
+  _buckets.reset(bucket);
+  return *bucket;
+}
+
+void Metrics::retire(Bucket* bucket)
+{
+  boost::mutex::scoped_lock lock(metrics._mutex);
+  metrics._free.push_back(bucket);
+}
+
+void Metrics::record(Op op, double seconds)
+{
+  Bucket& bucket = local();
+  unsigned long long nanos = (unsigned long long)(seconds * 1e9);
+  unsigned long long micros = nanos / 1000;
+
+  int i = 0;
+  while(i < NUM_LATENCIES && micros >= (1ULL << i)) {
+    i++;
+  }
+
+  bucket.ops[op]++;
+  bucket.nanos[op] += nanos;
+  bucket.latencies[op][i]++;
+}
+
+void Metrics::add(Counter counter, unsigned long long n)
+{
+  local().counters[counter] += n;
+}
+
+static void counter(ostringstream& out, const char* name, const char* help,
+                    unsigned long long value, const char* type = "counter")
+{
+  out << "# HELP " << name << " " << help << "\n"
+      << "# TYPE " << name << " " << type << "\n"
+      << name << " " << value << "\n";
+}
+
+string Metrics::render()
+{
+  Bucket total;
+  memset(&total, 0, sizeof(Bucket));
+
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    for(vector<Bucket*>::iterator b = _all.begin(); b != _all.end(); b++) {
+      Bucket& bucket = **b;
+      for(int op = 0; op < NUM_OPS; op++) {
+        total.ops[op] += bucket.ops[op];
+        total.nanos[op] += bucket.nanos[op];
+        for(int i = 0; i <= NUM_LATENCIES; i++) {
+          total.latencies[op][i] += bucket.latencies[op][i];
+        }
+      }
+      for(int c = 0; c < NUM_COUNTERS; c++) {
+        total.counters[c] += bucket.counters[c];
+      }
+    }
+  }
+
+  ostringstream out;
+
+  out << "# HELP gridfs_op_duration_seconds Time spent handling FUSE calls\n"
+      << "# TYPE gridfs_op_duration_seconds histogram\n";
+  for(int op = 0; op < NUM_OPS; op++) {
+    unsigned long long cumulative = 0;
+    for(int i = 0; i < NUM_LATENCIES; i++) {
+      cumulative += total.latencies[op][i];
+      out << "gridfs_op_duration_seconds_bucket{op=\"" << op_names[op]
+          << "\",le=\"" << (1ULL << i) / 1e6 << "\"} " << cumulative << "\n";
+    }
+    out << "gridfs_op_duration_seconds_bucket{op=\"" << op_names[op]
+        << "\",le=\"+Inf\"} " << total.ops[op] << "\n"
+        << "gridfs_op_duration_seconds_sum{op=\"" << op_names[op] << "\"} "
+        << total.nanos[op] / 1e9 << "\n"
+        << "gridfs_op_duration_seconds_count{op=\"" << op_names[op] << "\"} "
+        << total.ops[op] << "\n";
+  }
+
+  counter(out, "gridfs_read_bytes_total", "Bytes returned by read",
+          total.counters[BYTES_READ]);
+  counter(out, "gridfs_written_bytes_total", "Bytes accepted by write",
+          total.counters[BYTES_WRITTEN]);
+  counter(out, "gridfs_chunks_fetched_total", "Chunks read from mongod",
+          total.counters[CHUNKS_FETCHED]);
+  counter(out, "gridfs_chunks_uploaded_total", "Chunks written to mongod",
+          total.counters[CHUNKS_UPLOADED]);
+  counter(out, "gridfs_round_trips_total", "Requests sent to mongod",
+          total.counters[ROUND_TRIPS]);
+  counter(out, "gridfs_connections_opened_total", "Connections opened to mongod",
+          total.counters[CONNECTS]);
+  counter(out, "gridfs_stat_cache_hits_total", "Attribute lookups served from the stat cache",
+          total.counters[STAT_CACHE_HITS]);
+  counter(out, "gridfs_stat_cache_misses_total", "Attribute lookups that went to mongod",
+          total.counters[STAT_CACHE_MISSES]);
+  counter(out, "gridfs_chunk_cache_hits_total", "Chunk reads served from the chunk cache",
+          chunk_cache.hits());
+  counter(out, "gridfs_chunk_cache_misses_total", "Chunk reads that missed the chunk cache",
+          chunk_cache.misses());
+  counter(out, "gridfs_chunk_cache_bytes", "Bytes held by the chunk cache",
+          chunk_cache.size(), "gauge");
+  counter(out, "gridfs_disk_cache_hits_total", "Chunk reads served from the disk cache",
+          disk_cache.hits());
+  counter(out, "gridfs_disk_cache_misses_total", "Chunk reads that missed the disk cache",
+          disk_cache.misses());
+  counter(out, "gridfs_disk_cache_bytes", "Bytes held by the disk cache",
+          disk_cache.size(), "gauge");
+  counter(out, "gridfs_buffer_pool_hits_total", "Write buffers reused from the pool",
+          chunk_pool.hits());
+  counter(out, "gridfs_buffer_pool_misses_total", "Write buffers newly allocated",
+          chunk_pool.misses());
+
+  if(snapshot) {
+    counter(out, "gridfs_snapshot_files", "Files in the --readonly snapshot",
+            snapshot->files(), "gauge");
+    counter(out, "gridfs_snapshot_bytes", "Memory held by the --readonly snapshot",
+            snapshot->bytes(), "gauge");
+    counter(out, "gridfs_snapshot_bytes_per_file", "Memory held by the snapshot for each file",
+            snapshot->files() ? snapshot->bytes() / snapshot->files() : 0,
+            "gauge");
+    out << "# HELP gridfs_snapshot_load_seconds Time taken to load the snapshot at mount\n"
+        << "# TYPE gridfs_snapshot_load_seconds gauge\n"
+        << "gridfs_snapshot_load_seconds " << snapshot->loadSeconds() << "\n";
+    counter(out, "gridfs_snapshot_polls_total", "Times the snapshot was refreshed",
+            snapshot->polls());
+  }
+
+  return out.str();
+}
@@ -0,0 +1,91 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include "utils.h"
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+// Operation counts, latency histograms and a few counters, rendered in
+// the Prometheus text format for the virtual stats file. Every thread
+// updates its own bucket without locking; rendering sums the buckets,
+// so a snapshot can be a few updates behind.
+class Metrics {
+public:
+  enum Op {
+    OP_GETATTR, OP_READDIR, OP_OPEN, OP_CREATE, OP_RELEASE, OP_READ,
+    OP_WRITE, OP_FLUSH, OP_UNLINK, OP_RENAME, OP_LISTXATTR, OP_GETXATTR,
+    OP_SETXATTR, OP_REMOVEXATTR, OP_MKDIR, OP_RMDIR, NUM_OPS
+  };
+
+  enum Counter {
+    BYTES_READ, BYTES_WRITTEN, CHUNKS_FETCHED, CHUNKS_UPLOADED,
+    ROUND_TRIPS, CONNECTS, STAT_CACHE_HITS, STAT_CACHE_MISSES, NUM_COUNTERS
+  };
+
+  Metrics() : _buckets(retire) {}
+
+  void record(Op op, double seconds);
+  void add(Counter counter, unsigned long long n = 1);
+
+  std::string render();
+
+private:
+  // Latency buckets are powers of two from 1us up to about 8s
+  static const int NUM_LATENCIES = 24;
+
+  struct Bucket {
+    unsigned long long ops[NUM_OPS];
+    unsigned long long nanos[NUM_OPS];
+    unsigned long long latencies[NUM_OPS][NUM_LATENCIES + 1];
+    unsigned long long counters[NUM_COUNTERS];
+  };
+
+  Bucket& local();
+  // A bucket whose thread exited keeps its counts and goes to the next
+  // new thread
+  static void retire(Bucket* bucket);
+
+  // Every bucket ever handed out, and those whose threads have exited.
+  // Declared first so they outlive _buckets, which retires the calling
+  // thread's bucket as it's destroyed.
+  boost::mutex _mutex;
+  std::vector<Bucket*> _all;
+  std::vector<Bucket*> _free;
+
+  boost::thread_specific_ptr<Bucket> _buckets;
+};
+
+extern Metrics metrics;
+
+// Records the time until it goes out of scope against op
+class OpTimer {
+public:
+  OpTimer(Metrics::Op op) : _op(op), _start(monotonic_time()) {}
+  ~OpTimer() { metrics.record(_op, monotonic_time() - _start); }
+
+private:
+  Metrics::Op _op;
+  double _start;
+};
+
+#endif
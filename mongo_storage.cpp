@@ -0,0 +1,268 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mongo_storage.h"
+#include "connection_pool.h"
+#include "metrics.h"
+#include "options.h"
+#include "utils.h"
+
+using namespace std;
+using namespace mongo;
+
+// The only index checks the mount makes; operations then go straight to
+// their queries. uploadDate serves the --poll queries of listUpdated.
+void MongoStorage::prepare()
+{
+  Connection conn;
+  conn->ensureIndex(files_ns(gridfs_options.db), BSON("filename" << 1));
+  conn->ensureIndex(files_ns(gridfs_options.db), BSON("uploadDate" << 1));
+  conn->ensureIndex(chunks_ns(gridfs_options.db),
+                    BSON("files_id" << 1 << "n" << 1), true);
+  conn.done();
+}
+
+// A flush adds a file's new version before dropping the old one, so for
+// a moment a name can have two documents; this picks the newer
+static Query newest(const string& filename)
+{
+  return Query(BSON("filename" << filename)).sort("uploadDate", -1);
+}
+
+BSONObj MongoStorage::findFile(const string& filename, const BSONObj* fields)
+{
+  Connection conn;
+  metrics.add(Metrics::ROUND_TRIPS);
+  BSONObj file = conn->findOne(files_ns(gridfs_options.db),
+                               newest(filename), fields);
+  conn.done();
+  return file;
+}
+
+void MongoStorage::listFiles(const string& lower, const string& upper,
+                             const BSONObj* fields, const FileSink& sink,
+                             int limit)
+{
+  BSONObj range = upper.empty() ?
+    BSON("$gte" << lower) : BSON("$gte" << lower << "$lt" << upper);
+
+  Connection conn;
+  metrics.add(Metrics::ROUND_TRIPS);
+  auto_ptr<DBClientCursor> cursor =
+    conn->query(files_ns(gridfs_options.db),
+                Query(BSON("filename" << range)).sort("filename"),
+                limit, 0, fields);
+
+  while(cursor->more()) {
+    if(!sink(cursor->next())) {
+      break;
+    }
+  }
+
+  conn.done();
+}
+
+void MongoStorage::listUpdated(unsigned long long since,
+                               const BSONObj* fields, const FileSink& sink)
+{
+  Connection conn;
+  metrics.add(Metrics::ROUND_TRIPS);
+  auto_ptr<DBClientCursor> cursor =
+    conn->query(files_ns(gridfs_options.db),
+                BSON("uploadDate" << BSON("$gte" << Date_t(since))),
+                0, 0, fields);
+
+  while(cursor->more()) {
+    if(!sink(cursor->next())) {
+      break;
+    }
+  }
+
+  conn.done();
+}
+
+vector<BSONObj> MongoStorage::findVersions(const string& filename)
+{
+  BSONObj id_field = BSON("_id" << 1);
+  vector<BSONObj> ids;
+
+  Connection conn;
+  metrics.add(Metrics::ROUND_TRIPS);
+  auto_ptr<DBClientCursor> cursor =
+    conn->query(files_ns(gridfs_options.db),
+                BSON("filename" << filename), 0, 0, &id_field);
+  while(cursor->more()) {
+    ids.push_back(cursor->next().getOwned());
+  }
+  conn.done();
+
+  return ids;
+}
+
+bool MongoStorage::putFile(const BSONObj& id, const BSONObj& fields)
+{
+  Connection conn;
+  conn->update(files_ns(gridfs_options.db), id,
+               BSON("$set" << fields), true);
+  metrics.add(Metrics::ROUND_TRIPS);
+  bool ok = conn->getLastError().empty();
+  conn.done();
+  return ok;
+}
+
+bool MongoStorage::removeFile(const BSONObj& id)
+{
+  Connection conn;
+  conn->remove(files_ns(gridfs_options.db), id);
+  metrics.add(Metrics::ROUND_TRIPS);
+  bool ok = conn->getLastError().empty();
+  conn.done();
+  return ok;
+}
+
+bool MongoStorage::updateFile(const BSONObj& id, const BSONObj& fields)
+{
+  Connection conn;
+  conn->update(files_ns(gridfs_options.db), id, BSON("$set" << fields));
+  metrics.add(Metrics::ROUND_TRIPS);
+  BSONObj info = conn->getLastErrorDetailed();
+  conn.done();
+  return info["err"].isNull() && info["n"].numberInt() > 0;
+}
+
+bool MongoStorage::renameFile(const string& oldName, const string& newName)
+{
+  Connection conn;
+  DBClientBase &client = conn.conn();
+
+  BSONObj id_field = BSON("_id" << 1);
+  metrics.add(Metrics::ROUND_TRIPS);
+  BSONObj file_obj = client.findOne(files_ns(gridfs_options.db),
+                                    newest(oldName), &id_field);
+
+  if(file_obj.isEmpty()) {
+    conn.done();
+    return false;
+  }
+
+  // Only the name changes, so a concurrent setxattr's update survives
+  client.update(files_ns(gridfs_options.db),
+                BSON("_id" << file_obj["_id"]),
+                BSON("$set" << BSON("filename" << newName)));
+  metrics.add(Metrics::ROUND_TRIPS);
+  bool ok = client.getLastError().empty();
+
+  conn.done();
+  return ok;
+}
+
+// findAndModify, since a plain update can't pick the newest of several
+// versions. One round trip either way.
+static bool update_newest(const string& filename, const BSONObj& update)
+{
+  BSONObj info;
+  Connection conn;
+  metrics.add(Metrics::ROUND_TRIPS);
+  bool ok = conn->runCommand(gridfs_options.db,
+                             BSON("findAndModify" << "fs.files"
+                                  << "query" << BSON("filename" << filename)
+                                  << "sort" << BSON("uploadDate" << -1)
+                                  << "update" << update
+                                  << "fields" << BSON("_id" << 1)),
+                             info);
+  conn.done();
+
+  return ok && info["value"].type() == Object;
+}
+
+bool MongoStorage::setMetadata(const string& filename, const string& name,
+                               const string& value)
+{
+  return update_newest(filename,
+                       BSON("$set" << BSON("metadata." + name << value)));
+}
+
+bool MongoStorage::removeMetadata(const string& filename, const string& name)
+{
+  return update_newest(filename,
+                       BSON("$unset" << BSON("metadata." + name << 1)));
+}
+
+int MongoStorage::fetchChunks(const BSONObj& id, int first, int last,
+                              const ChunkDataSink& sink)
+{
+  int fetched = 0;
+
+  Connection conn;
+  metrics.add(Metrics::ROUND_TRIPS);
+  auto_ptr<DBClientCursor> cursor =
+    conn->query(chunks_ns(gridfs_options.db),
+                Query(BSON("files_id" << id["_id"]
+                           << "n" << BSON("$gte" << first
+                                          << "$lt" << last))).sort("n"));
+
+  while(cursor->more()) {
+    BSONObj chunk_obj = cursor->next();
+    int len;
+    const char* data = chunk_obj["data"].binData(len);
+    sink(chunk_obj["n"].numberInt(), data, len);
+    fetched++;
+  }
+
+  conn.done();
+  return fetched;
+}
+
+bool MongoStorage::putChunk(const BSONObj& id, int n, const char* data, int len)
+{
+  BSONObjBuilder chunk;
+  chunk << "files_id" << id["_id"] << "n" << n;
+  chunk.appendBinData("data", len, BinDataGeneral, data);
+
+  Connection conn;
+  conn->update(chunks_ns(gridfs_options.db),
+               BSON("files_id" << id["_id"] << "n" << n),
+               chunk.obj(), true);
+  metrics.add(Metrics::ROUND_TRIPS);
+  bool ok = conn->getLastError().empty();
+  conn.done();
+  return ok;
+}
+
+bool MongoStorage::removeChunks(const BSONObj& id)
+{
+  Connection conn;
+  conn->remove(chunks_ns(gridfs_options.db),
+               BSON("files_id" << id["_id"]));
+  metrics.add(Metrics::ROUND_TRIPS);
+  bool ok = conn->getLastError().empty();
+  conn.done();
+  return ok;
+}
+
+string MongoStorage::fileMD5(const BSONObj& id)
+{
+  BSONObj info;
+  Connection conn;
+  metrics.add(Metrics::ROUND_TRIPS);
+  bool ok = conn->runCommand(gridfs_options.db,
+                             BSON("filemd5" << id["_id"] << "root" << "fs"),
+                             info);
+  conn.done();
+
+  return ok ? info.getStringField("md5") : "";
+}
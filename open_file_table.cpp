@@ -0,0 +1,193 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "open_file_table.h"
+#include <algorithm>
+
+#include <boost/functional/hash.hpp>
+
+using namespace std;
+using namespace mongo;
+
+OpenFileTable open_files;
+
+OpenFileTable::Shard& OpenFileTable::shardFor(const string& path)
+{
+  return _shards[boost::hash<string>()(path) % NUM_SHARDS];
+}
+
+void OpenFileTable::addHandle(FileHandle* fh)
+{
+  Shard& shard = shardFor(fh->path());
+  boost::mutex::scoped_lock lock(shard.mutex);
+  shard.entries[fh->path()].handles.push_back(fh);
+}
+
+void OpenFileTable::removeHandle(FileHandle* fh)
+{
+  Shard& shard = shardFor(fh->path());
+  boost::mutex::scoped_lock lock(shard.mutex);
+
+  map<string, Entry>::iterator i = shard.entries.find(fh->path());
+  if(i == shard.entries.end()) {
+    return;
+  }
+
+  vector<FileHandle*>& handles = i->second.handles;
+  handles.erase(remove(handles.begin(), handles.end(), fh), handles.end());
+  i->second.stale.erase(fh);
+  if(handles.empty() && !i->second.writer) {
+    shard.entries.erase(i);
+  }
+}
+
+void OpenFileTable::setWriter(const string& path, const WriterPtr& writer)
+{
+  Shard& shard = shardFor(path);
+  boost::mutex::scoped_lock lock(shard.mutex);
+  shard.entries[path].writer = writer;
+}
+
+WriterPtr OpenFileTable::addWriter(const string& path, const WriterPtr& writer)
+{
+  Shard& shard = shardFor(path);
+  boost::mutex::scoped_lock lock(shard.mutex);
+
+  Entry& entry = shard.entries[path];
+  if(!entry.writer) {
+    entry.writer = writer;
+  }
+  return entry.writer;
+}
+
+void OpenFileTable::removeWriter(const string& path, const WriterPtr& writer)
+{
+  Shard& shard = shardFor(path);
+  boost::mutex::scoped_lock lock(shard.mutex);
+
+  map<string, Entry>::iterator i = shard.entries.find(path);
+  if(i == shard.entries.end() || i->second.writer != writer) {
+    return;
+  }
+
+  vector<FileHandle*>& handles = i->second.handles;
+  for(vector<FileHandle*>::iterator h = handles.begin(); h != handles.end(); h++) {
+    if((*h)->writer() == writer) {
+      return;
+    }
+  }
+
+  i->second.writer.reset();
+  if(i->second.handles.empty()) {
+    shard.entries.erase(i);
+  }
+}
+
+WriterPtr OpenFileTable::writer(const string& path)
+{
+  Shard& shard = shardFor(path);
+  boost::mutex::scoped_lock lock(shard.mutex);
+
+  map<string, Entry>::iterator i = shard.entries.find(path);
+  if(i == shard.entries.end()) {
+    return WriterPtr();
+  }
+  return i->second.writer;
+}
+
+BSONObj OpenFileTable::openFile(const string& path)
+{
+  Shard& shard = shardFor(path);
+  boost::mutex::scoped_lock lock(shard.mutex);
+
+  map<string, Entry>::iterator i = shard.entries.find(path);
+  if(i != shard.entries.end()) {
+    vector<FileHandle*>& handles = i->second.handles;
+    for(vector<FileHandle*>::iterator h = handles.begin();
+        h != handles.end(); h++) {
+      BSONObj file;
+      if(!i->second.stale.count(*h) && (*h)->getFile(file)) {
+        return file;
+      }
+    }
+  }
+  return BSONObj();
+}
+
+void OpenFileTable::invalidate(const string& path)
+{
+  Shard& shard = shardFor(path);
+  boost::mutex::scoped_lock lock(shard.mutex);
+
+  map<string, Entry>::iterator i = shard.entries.find(path);
+  if(i != shard.entries.end()) {
+    i->second.stale.insert(i->second.handles.begin(),
+                           i->second.handles.end());
+  }
+}
+
+bool OpenFileTable::usesFile(const string& cacheId)
+{
+  for(int s = 0; s < NUM_SHARDS; s++) {
+    boost::mutex::scoped_lock lock(_shards[s].mutex);
+    map<string, Entry>& entries = _shards[s].entries;
+
+    for(map<string, Entry>::iterator i = entries.begin();
+        i != entries.end(); i++) {
+      if(i->second.writer && i->second.writer->usesFile(cacheId)) {
+        return true;
+      }
+
+      // A handle can still write, or read, through a writer its path has
+      // since been given a new one in place of
+      vector<FileHandle*>& handles = i->second.handles;
+      for(vector<FileHandle*>::iterator h = handles.begin();
+          h != handles.end(); h++) {
+        BSONObj file;
+        if((*h)->getFile(file) &&
+           file["_id"].toString(false) == cacheId) {
+          return true;
+        } else if((*h)->readWriter() &&
+                  (*h)->readWriter()->usesFile(cacheId)) {
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+vector<pair<string, WriterPtr> > OpenFileTable::writersUnder(const string& prefix)
+{
+  vector<pair<string, WriterPtr> > writers;
+
+  for(int s = 0; s < NUM_SHARDS; s++) {
+    boost::mutex::scoped_lock lock(_shards[s].mutex);
+    map<string, Entry>& entries = _shards[s].entries;
+
+    for(map<string, Entry>::iterator i = entries.lower_bound(prefix);
+        i != entries.end() && i->first.compare(0, prefix.size(), prefix) == 0;
+        i++) {
+      if(i->second.writer) {
+        writers.push_back(make_pair(i->first, i->second.writer));
+      }
+    }
+  }
+
+  return writers;
+}
@@ -0,0 +1,89 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __OPEN_FILE_TABLE_H
+#define __OPEN_FILE_TABLE_H
+
+#include "file_handle.h"
+#include "gridfile_writer.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+#include <mongo/client/dbclient.h>
+
+// Every open handle and every file being written, by path. Handles find
+// their own state through fuse_file_info::fh; this is for the calls
+// that only get a path. Paths are hashed over independently locked
+// shards so unrelated files never contend.
+class OpenFileTable {
+public:
+  void addHandle(FileHandle* fh);
+  void removeHandle(FileHandle* fh);
+
+  // Makes writer the file that reads and stats of path see
+  void setWriter(const std::string& path, const WriterPtr& writer);
+  // Like setWriter unless path already has a writer, which is returned
+  // instead
+  WriterPtr addWriter(const std::string& path, const WriterPtr& writer);
+  // Forgets path's writer, unless it has since been replaced or another
+  // open handle still writes through it
+  void removeWriter(const std::string& path, const WriterPtr& writer);
+  WriterPtr writer(const std::string& path);
+
+  // The fs.files document from any open handle on path, or an empty
+  // object if none has one
+  mongo::BSONObj openFile(const std::string& path);
+
+  // path now names a different version, or nothing. Handles already
+  // open keep the version they resolved but openFile stops returning it.
+  void invalidate(const std::string& path);
+
+  // Whether any open handle or writer uses the version with chunk cache
+  // key cacheId
+  bool usesFile(const std::string& cacheId);
+
+  // Files being written whose path starts with prefix
+  std::vector<std::pair<std::string, WriterPtr> >
+    writersUnder(const std::string& prefix);
+
+private:
+  static const int NUM_SHARDS = 16;
+
+  struct Entry {
+    WriterPtr writer;
+    std::vector<FileHandle*> handles;
+    // Handles resolved before the last invalidate
+    std::set<FileHandle*> stale;
+  };
+
+  struct Shard {
+    boost::mutex mutex;
+    std::map<std::string, Entry> entries;
+  };
+
+  Shard& shardFor(const std::string& path);
+
+  Shard _shards[NUM_SHARDS];
+};
+
+extern OpenFileTable open_files;
+
+#endif
@@ -18,14 +18,20 @@
 #include "operations.h"
 #include "options.h"
 #include "utils.h"
-#include "local_gridfile.h"
+#include "open_file_table.h"
+#include "chunk_gc.h"
+#include "connection_pool.h"
+#include "disk_cache.h"
+#include "storage.h"
+#include "metrics.h"
+#include "read_ahead.h"
+#include "stat_cache.h"
+#include "directory.h"
 #include <algorithm>
 #include <cstring>
 #include <cerrno>
 #include <fcntl.h>
-
-#include <mongo/client/gridfs.h>
-#include <mongo/client/connpool.h>
+#include <stdint.h>
 
 #ifdef __linux__
 #include <sys/xattr.h>
@@ -34,91 +40,222 @@
 using namespace std;
 using namespace mongo;
 
-std::map<string, LocalGridFile*> open_files;
+// Read-only files the mount generates itself
+static const char* VIRTUAL_DIR = ".gridfs";
+static const char* STATS_FILE = ".gridfs/stats";
+
+static bool is_virtual(const char* path)
+{
+  size_t len = strlen(VIRTUAL_DIR);
+  return strncmp(path, VIRTUAL_DIR, len) == 0 &&
+    (path[len] == '\0' || path[len] == '/');
+}
+
+static inline FileHandle* get_handle(struct fuse_file_info* fi)
+{
+  return (FileHandle*)(uintptr_t)fi->fh;
+}
+
+static void set_handle(struct fuse_file_info* fi, FileHandle* fh)
+{
+  fi->fh = (uintptr_t)fh;
+  open_files.addHandle(fh);
+}
+
+void* gridfs_init(struct fuse_conn_info* conn)
+{
+  storage->prepare();
+  read_ahead.start(gridfs_options.readahead_threads,
+                   gridfs_options.readahead);
+  upload_queue.start(gridfs_options.upload_threads);
+  chunk_gc.start();
+  disk_cache.start();
+  return NULL;
+}
+
+void gridfs_destroy(void* data)
+{
+  storage->close();
+  read_ahead.stop();
+  upload_queue.stop();
+  chunk_gc.stop();
+  disk_cache.stop();
+  connections.flush();
+}
 
-unsigned int FH = 1;
+// Whether any file being written lives somewhere under path
+static bool has_open_children(const string& path)
+{
+  return !open_files.writersUnder(path + "/").empty();
+}
 
 int gridfs_getattr(const char *path, struct stat *stbuf)
 {
-  int res = 0;
+  OpTimer timer(Metrics::OP_GETATTR);
+
   memset(stbuf, 0, sizeof(struct stat));
 
   if(strcmp(path, "/") == 0) {
-    stbuf->st_mode = S_IFDIR | 0777;
-    stbuf->st_nlink = 2;
+    directory_stat(stbuf);
     return 0;
   }
 
   path = fuse_to_mongo_path(path);
 
-  map<string,LocalGridFile*>::const_iterator file_iter;
-  file_iter = open_files.find(path);
+  if(is_virtual(path)) {
+    if(strcmp(path, VIRTUAL_DIR) == 0) {
+      directory_stat(stbuf);
+      return 0;
+    } else if(strcmp(path, STATS_FILE) == 0) {
+      // Its size isn't known until it's opened; direct_io lets reads
+      // run to the end anyway
+      stbuf->st_mode = S_IFREG | 0444;
+      stbuf->st_nlink = 1;
+      stbuf->st_ctime = time(NULL);
+      stbuf->st_mtime = time(NULL);
+      return 0;
+    }
+    return -ENOENT;
+  }
 
-  if(file_iter != open_files.end()) {
+  WriterPtr writer = open_files.writer(path);
+  if(writer) {
     stbuf->st_mode = S_IFREG | 0555;
     stbuf->st_nlink = 1;
     stbuf->st_ctime = time(NULL);
     stbuf->st_mtime = time(NULL);
-    stbuf->st_size = file_iter->second->getLength();
+    stbuf->st_size = writer->getLength();
     return 0;
   }
 
-  // HACK: This is a protective measure to ensure we don't spin off into forever if a path without a period is requested.
-  if(path_depth(path) > 10) {
-    return -ENOENT;
-  }
-
-  // HACK: Assumes that if the last part of the path has a '.' in it, it's the leaf of the path, and if we haven't found a match by now,
-  // give up and go home. This works just dandy as long as you avoid putting periods in your 'directory' names.
-  if(!is_leaf(path)) {
-    stbuf->st_mode = S_IFDIR | 0777;
-    stbuf->st_nlink = 2;
+  if(has_open_children(path)) {
+    directory_stat(stbuf);
     return 0;
   }
 
-  ScopedDbConnection sdc(gridfs_options.host);
-  GridFS gf(sdc.conn(), gridfs_options.db);
-  GridFile file = gf.findFile(path);
-  sdc.done();
-
-  if(!file.exists()) {
+  bool exists;
+  if(stat_cache.get(path, stbuf, exists)) {
+    metrics.add(Metrics::STAT_CACHE_HITS);
+    return exists ? 0 : -ENOENT;
+  }
+  metrics.add(Metrics::STAT_CACHE_MISSES);
+
+  // The metadata comes along so the xattr calls that often follow a
+  // stat don't need a query of their own
+  BSONObj fields = stat_fields(true);
+  BSONObj file = storage->findFile(path, &fields);
+
+  if(!file.isEmpty()) {
+    file_stat(file, stbuf);
+    BSONObj metadata = file.getObjectField("metadata");
+    stat_cache.put(path, *stbuf, &metadata);
+  } else if(directory_exists(path)) {
+    directory_stat(stbuf);
+    stat_cache.put(path, *stbuf);
+  } else {
+    stat_cache.putNegative(path);
     return -ENOENT;
   }
 
-  stbuf->st_mode = S_IFREG | 0555;
-  stbuf->st_nlink = 1;
-  stbuf->st_size = file.getContentLength();
+  return 0;
+}
 
-  time_t upload_time = mongo_time_to_unix_time(file.getUploadDate());
-  stbuf->st_ctime = upload_time;
-  stbuf->st_mtime = upload_time;
+namespace {
+  // Hands directory entries to FUSE, skipping names already reported
+  // from open_files and remembering file attributes for the stat calls
+  // that usually follow a listing
+  class DirFiller {
+  public:
+    DirFiller(void* buf, fuse_fill_dir_t filler, const string& prefix,
+              const map<string, struct stat>& skip) :
+      _buf(buf), _filler(filler), _prefix(prefix), _skip(skip) {}
+
+    bool operator()(const string& name, const struct stat& st) {
+      if(_skip.find(name) != _skip.end()) {
+        return true;
+      }
+      if(S_ISREG(st.st_mode)) {
+        stat_cache.put(_prefix + name, st);
+      }
+      return _filler(_buf, name.c_str(), &st, 0) == 0;
+    }
 
-  return 0;
+  private:
+    void* _buf;
+    fuse_fill_dir_t _filler;
+    const string& _prefix;
+    const map<string, struct stat>& _skip;
+  };
 }
 
 int gridfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
            off_t offset, struct fuse_file_info *fi)
 {
-  if(strcmp(path, "/") != 0)
-    return -ENOENT;
+  OpTimer timer(Metrics::OP_READDIR);
 
-  filler(buf, ".", NULL, 0);
-  filler(buf, "..", NULL, 0);
+  bool root = strcmp(path, "/") == 0;
+  path = fuse_to_mongo_path(path);
+  string prefix = root ? "" : string(path) + "/";
 
-  ScopedDbConnection sdc(gridfs_options.host);
-  GridFS gf(sdc.conn(), gridfs_options.db);
+  if(is_virtual(path)) {
+    if(strcmp(path, VIRTUAL_DIR) != 0) {
+      return -ENOENT;
+    }
+    struct stat dir_st, stats_st;
+    directory_stat(&dir_st);
+    gridfs_getattr(("/" + string(STATS_FILE)).c_str(), &stats_st);
 
-  auto_ptr<DBClientCursor> cursor = gf.list();
-  while(cursor->more()) {
-    BSONObj f = cursor->next();
-    filler(buf, f.getStringField("filename") , NULL , 0);
+    filler(buf, ".", &dir_st, 0);
+    filler(buf, "..", &dir_st, 0);
+    filler(buf, STATS_FILE + strlen(VIRTUAL_DIR) + 1, &stats_st, 0);
+    return 0;
   }
-  sdc.done();
 
-  for(map<string,LocalGridFile*>::const_iterator i = open_files.begin();
-    i != open_files.end(); i++)
+  // Files that are still being written, directories implied by them and
+  // directories made with mkdir
+  map<string, struct stat> local;
+  vector<pair<string, WriterPtr> > writers = open_files.writersUnder(prefix);
+  for(vector<pair<string, WriterPtr> >::const_iterator i = writers.begin();
+    i != writers.end(); i++)
   {
-    filler(buf, i->first.c_str(), NULL, 0);
+    string name = i->first.substr(prefix.size());
+    struct stat st;
+    memset(&st, 0, sizeof(struct stat));
+
+    size_t slash = name.find('/');
+    if(slash != string::npos) {
+      name = name.substr(0, slash);
+      directory_stat(&st);
+    } else {
+      st.st_mode = S_IFREG | 0555;
+      st.st_nlink = 1;
+      st.st_size = i->second->getLength();
+    }
+    local[name] = st;
+  }
+
+  struct stat dir_st;
+  directory_stat(&dir_st);
+
+  vector<string> made = made_directories(root ? "" : path);
+  for(vector<string>::iterator i = made.begin(); i != made.end(); i++) {
+    local[*i] = dir_st;
+  }
+
+  filler(buf, ".", &dir_st, 0);
+  filler(buf, "..", &dir_st, 0);
+
+  for(map<string, struct stat>::const_iterator i = local.begin();
+    i != local.end(); i++)
+  {
+    filler(buf, i->first.c_str(), &i->second, 0);
+  }
+
+  int listed = list_directory(root ? "" : path,
+                              DirFiller(buf, filler, prefix, local));
+
+  if(!root && !listed && local.empty() && !directory_exists(path)) {
+    return -ENOENT;
   }
 
   return 0;
@@ -126,134 +263,278 @@ int gridfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 
 int gridfs_open(const char *path, struct fuse_file_info *fi)
 {
+  OpTimer timer(Metrics::OP_OPEN);
+
   path = fuse_to_mongo_path(path);
 
+  if(is_virtual(path)) {
+    if(strcmp(path, STATS_FILE) != 0) {
+      return -ENOENT;
+    } else if((fi->flags & O_ACCMODE) != O_RDONLY) {
+      return -EACCES;
+    }
+
+    FileHandle* fh = new FileHandle(path);
+    fh->setContents(metrics.render());
+    fi->direct_io = 1;
+    set_handle(fi, fh);
+    return 0;
+  }
+
   if((fi->flags & O_ACCMODE) == O_RDONLY) {
-    if(open_files.find(path) != open_files.end()) {
-      return 0;
+    FileHandle* fh = new FileHandle(path);
+
+    // Files still being written are read from the local copy, so
+    // there's nothing to resolve yet
+    WriterPtr writer = open_files.writer(path);
+    if(writer) {
+      fh->setReadWriter(writer);
+    } else {
+      BSONObj file = open_files.openFile(path);
+      if(!file.isEmpty()) {
+        fh->setFile(file);
+      } else if(!fh->load()) {
+        delete fh;
+        return -ENOENT;
+      }
     }
 
-    ScopedDbConnection sdc(gridfs_options.host);
-    GridFS gf(sdc.conn(), gridfs_options.db);
-    GridFile file = gf.findFile(path);
-    sdc.done();
+    // A snapshot that's never refreshed can't change, so what the kernel
+    // has cached of its files stays good across opens
+    if(gridfs_options.readonly && !gridfs_options.poll) {
+      fi->keep_cache = 1;
+    }
 
-    if(file.exists()) {
-      return 0;
+    set_handle(fi, fh);
+    return 0;
+  } else if(gridfs_options.readonly) {
+    return -EROFS;
+  }
+
+  // Opened for writing. Every handle on the file writes through the same
+  // writer, which turns the edits into a new version of the stored file.
+  WriterPtr writer = open_files.writer(path);
+  if(!writer) {
+    BSONObj file = storage->findFile(path);
+    if(file.isEmpty()) {
+      return -ENOENT;
     }
 
-    return -ENOENT;
-  } else {
-    return -EACCES;
+    writer = open_files.addWriter(path, WriterPtr(new GridFileWriter(file)));
+    stat_cache.invalidate(path);
   }
+
+  FileHandle* fh = new FileHandle(path, writer);
+  fh->setAppend(fi->flags & O_APPEND);
+  set_handle(fi, fh);
+  return 0;
 }
 
 int gridfs_create(const char* path, mode_t mode, struct fuse_file_info* ffi)
 {
+  OpTimer timer(Metrics::OP_CREATE);
+
   path = fuse_to_mongo_path(path);
+  if(is_virtual(path)) {
+    return -EACCES;
+  } else if(gridfs_options.readonly) {
+    return -EROFS;
+  }
 
-  open_files[path] = new LocalGridFile(DEFAULT_CHUNK_SIZE);
+  WriterPtr writer(new GridFileWriter(path));
+  open_files.setWriter(path, writer);
+  stat_cache.invalidate(path);
 
-  ffi->fh = FH++;
+  set_handle(ffi, new FileHandle(path, writer));
 
   return 0;
 }
 
 int gridfs_release(const char* path, struct fuse_file_info* ffi)
 {
-  path = fuse_to_mongo_path(path);
-
-  if(!ffi->fh) {
-    // fh is not set if file is opened read only
-    // Would check ffi->flags for O_RDONLY instead but MacFuse doesn't
-    // seem to properly pass flags into release
+  FileHandle* fh = get_handle(ffi);
+  if(!fh) {
     return 0;
   }
 
-  delete open_files[path];
-  open_files.erase(path);
+  gridfs_release_handle(fh);
 
   return 0;
 }
 
+void gridfs_release_handle(FileHandle* fh)
+{
+  OpTimer timer(Metrics::OP_RELEASE);
+
+  open_files.removeHandle(fh);
+
+  // Would check ffi->flags for O_RDONLY instead but MacFuse doesn't
+  // seem to properly pass flags into release
+  if(fh->writable()) {
+    open_files.removeWriter(fh->path(), fh->writer());
+  }
+
+  delete fh;
+  chunk_gc.sweep();
+}
+
 int gridfs_unlink(const char* path) {
+  OpTimer timer(Metrics::OP_UNLINK);
+
   path = fuse_to_mongo_path(path);
+  if(is_virtual(path)) {
+    return -EACCES;
+  } else if(gridfs_options.readonly) {
+    return -EROFS;
+  }
+
+  // Handles still open on the file keep reading its chunks, so only the
+  // fs.files documents go now
+  vector<BSONObj> ids = storage->findVersions(path);
+  for(vector<BSONObj>::iterator i = ids.begin(); i != ids.end(); i++) {
+    if(storage->removeFile(*i)) {
+      chunk_gc.collect(*i);
+    }
+  }
 
-  ScopedDbConnection sdc(gridfs_options.host);
-  GridFS gf(sdc.conn(), gridfs_options.db);
-  gf.removeFile(path);
-  sdc.done();
+  stat_cache.invalidate(path);
+  open_files.invalidate(path);
 
   return 0;
 }
 
-int gridfs_read(const char *path, char *buf, size_t size, off_t offset,
-        struct fuse_file_info *fi)
+int gridfs_mkdir(const char* path, mode_t mode)
+{
+  OpTimer timer(Metrics::OP_MKDIR);
+
+  path = fuse_to_mongo_path(path);
+  if(is_virtual(path)) {
+    return -EACCES;
+  } else if(gridfs_options.readonly) {
+    return -EROFS;
+  }
+
+  struct stat st;
+  if(gridfs_getattr(("/" + string(path)).c_str(), &st) == 0) {
+    return -EEXIST;
+  }
+
+  make_directory(path);
+  stat_cache.invalidate(path);
+
+  return 0;
+}
+
+static bool stop_listing(const string& name, const struct stat& st)
+{
+  return false;
+}
+
+int gridfs_rmdir(const char* path)
 {
+  OpTimer timer(Metrics::OP_RMDIR);
+
   path = fuse_to_mongo_path(path);
-  size_t len = 0;
+  if(is_virtual(path)) {
+    return -EACCES;
+  } else if(gridfs_options.readonly) {
+    return -EROFS;
+  }
 
-  map<string,LocalGridFile*>::const_iterator file_iter;
-  file_iter = open_files.find(path);
-  if(file_iter != open_files.end()) {
-    LocalGridFile *lgf = file_iter->second;
-    return lgf->read(buf, size, offset);
+  if(has_open_children(path) || !made_directories(path).empty() ||
+     list_directory(path, stop_listing)) {
+    return -ENOTEMPTY;
+  } else if(!remove_made_directory(path)) {
+    return -ENOENT;
   }
 
-  ScopedDbConnection sdc(gridfs_options.host);
-  GridFS gf(sdc.conn(), gridfs_options.db);
-  GridFile file = gf.findFile(path);
+  stat_cache.invalidate(path);
+
+  return 0;
+}
+
+int gridfs_read(const char *path, char *buf, size_t size, off_t offset,
+        struct fuse_file_info *fi)
+{
+  return gridfs_read_handle(get_handle(fi), buf, size, offset);
+}
 
-  if(!file.exists()) {
-    sdc.done();
+int gridfs_read_handle(FileHandle* fh, char *buf, size_t size, off_t offset)
+{
+  OpTimer timer(Metrics::OP_READ);
+  int res;
+
+  if(fh->isVirtual()) {
+    res = fh->readContents(buf, size, offset);
+  } else if(fh->readWriter()) {
+    res = fh->readWriter()->read(buf, size, offset);
+  } else if(!fh->exists() && !fh->load()) {
+    // A handle opened while the file was still being written has no
+    // record until the writer has flushed it
     return -EBADF;
+  } else {
+    res = fh->read(buf, size, offset);
   }
 
-  int chunk_size = file.getChunkSize();
-  int chunk_num = offset / chunk_size;
+  if(res > 0) {
+    metrics.add(Metrics::BYTES_READ, res);
+  }
+  return res;
+}
 
-  while(len < size && chunk_num < file.getNumChunks()) {
-    GridFSChunk chunk = file.getChunk(chunk_num);
-    int to_read;
-    int cl = chunk.len();
+// A new file has no fs.files document, and so no xattrs, until its
+// first flush. An existing file open for writing still has its own.
+static bool unstored(const char* path)
+{
+  WriterPtr writer = open_files.writer(path);
+  return writer && !writer->stored();
+}
 
-    const char *d = chunk.data(cl);
+// From an open handle's document or the stat cache if either has it,
+// else one query whose result goes in the stat cache
+static bool get_metadata(const char* path, BSONObj& metadata)
+{
+  BSONObj file = open_files.openFile(path);
+  if(!file.isEmpty()) {
+    metadata = file.getObjectField("metadata");
+    return true;
+  }
 
-    if(len) {
-      to_read = min((long unsigned)cl, (long unsigned)(size - len));
-      memcpy(buf + len, d, to_read);
-    } else {
-      to_read = min((long unsigned)(cl - (offset % chunk_size)), (long unsigned)(size - len));
-      memcpy(buf + len, d + (offset % chunk_size), to_read);
-    }
+  if(stat_cache.getMetadata(path, metadata)) {
+    metrics.add(Metrics::STAT_CACHE_HITS);
+    return true;
+  }
+  metrics.add(Metrics::STAT_CACHE_MISSES);
 
-    len += to_read;
-    chunk_num++;
+  BSONObj fields = stat_fields(true);
+  file = storage->findFile(path, &fields);
+  if(file.isEmpty()) {
+    return false;
   }
 
-  sdc.done();
-  return len;
+  struct stat st;
+  file_stat(file, &st);
+  metadata = file.getObjectField("metadata");
+  stat_cache.put(path, st, &metadata);
+  return true;
 }
 
 int gridfs_listxattr(const char* path, char* list, size_t size)
 {
+  OpTimer timer(Metrics::OP_LISTXATTR);
+
   path = fuse_to_mongo_path(path);
 
-  if(open_files.find(path) != open_files.end()) {
+  if(is_virtual(path) || unstored(path)) {
     return 0;
   }
 
-  ScopedDbConnection sdc(gridfs_options.host);
-  GridFS gf(sdc.conn(), gridfs_options.db);
-  GridFile file = gf.findFile(path);
-  sdc.done();
-
-  if(!file.exists()) {
+  BSONObj metadata;
+  if(!get_metadata(path, metadata)) {
     return -ENOENT;
   }
 
   int len = 0;
-  BSONObj metadata = file.getMetadata();
   set<string> field_set;
   metadata.getFieldNames(field_set);
   for(set<string>::const_iterator s = field_set.begin(); s != field_set.end(); s++) {
@@ -277,6 +558,8 @@ int gridfs_listxattr(const char* path, char* list, size_t size)
 
 int gridfs_getxattr(const char* path, const char* name, char* value, size_t size)
 {
+  OpTimer timer(Metrics::OP_GETXATTR);
+
   if(strcmp(path, "/") == 0) {
     return -ENOATTR;
   }
@@ -287,20 +570,15 @@ int gridfs_getxattr(const char* path, const char* name, char* value, size_t size
     return -ENOATTR;
   }
 
-  if(open_files.find(path) != open_files.end()) {
+  if(is_virtual(path) || unstored(path)) {
     return -ENOATTR;
   }
 
-  ScopedDbConnection sdc(gridfs_options.host);
-  GridFS gf(sdc.conn(), gridfs_options.db);
-  GridFile file = gf.findFile(path);
-  sdc.done();
-
-  if(!file.exists()) {
+  BSONObj metadata;
+  if(!get_metadata(path, metadata)) {
     return -ENOENT;
   }
 
-  BSONObj metadata = file.getMetadata();
   if(metadata.isEmpty()) {
     return -ENOATTR;
   }
@@ -310,8 +588,18 @@ int gridfs_getxattr(const char* path, const char* name, char* value, size_t size
     return -ENOATTR;
   }
 
-  string field_str = field.toString();
-  int len = field_str.size() + 1;
+  // Strings, which is all setxattr stores, come back as the bytes that
+  // were set
+  string field_str;
+  int len;
+  if(field.type() == String) {
+    field_str.assign(field.valuestr(), field.valuestrsize() - 1);
+    len = field_str.size();
+  } else {
+    field_str = field.toString();
+    len = field_str.size() + 1;
+  }
+
   if(size == 0) {
     return len;
   } else if(size < len) {
@@ -323,102 +611,195 @@ int gridfs_getxattr(const char* path, const char* name, char* value, size_t size
   return len;
 }
 
-int gridfs_setxattr(const char* path, const char* name, const char* value,
-          size_t size, int flags)
+// The metadata field an xattr name maps to, or NULL with err set
+static const char* xattr_field(const char* path, const char* name, int& err)
 {
-  return -ENOTSUP;
+  const char* attr_name = unnamespace_xattr(name);
+  if(!attr_name || strcmp(path, "/") == 0 || is_virtual(path)) {
+    err = -ENOTSUP;
+    return NULL;
+  }
+
+  // A dot would make it a path into a subdocument, and mongod rejects
+  // field names starting with $
+  if(!*attr_name || strchr(attr_name, '.') || attr_name[0] == '$') {
+    err = -EINVAL;
+    return NULL;
+  }
+
+  // There's no document to set it on until the file's first flush
+  if(unstored(path)) {
+    err = -EBUSY;
+    return NULL;
+  }
+
+  return attr_name;
 }
 
-int gridfs_write(const char* path, const char* buf, size_t nbyte,
-         off_t offset, struct fuse_file_info* ffi)
+// The document changed without a new version, so only the cached
+// copies of it need dropping
+static void metadata_changed(const char* path)
+{
+  stat_cache.invalidate(path);
+  open_files.invalidate(path);
+}
+
+int gridfs_setxattr(const char* path, const char* name, const char* value,
+          size_t size, int flags)
 {
+  OpTimer timer(Metrics::OP_SETXATTR);
+
+  if(gridfs_options.readonly) {
+    return -EROFS;
+  }
+
   path = fuse_to_mongo_path(path);
+  int err;
+  const char* attr_name = xattr_field(path, name, err);
+  if(!attr_name) {
+    return err;
+  }
 
-  if(open_files.find(path) == open_files.end()) {
-    return -ENOENT;
+  if(flags & (XATTR_CREATE | XATTR_REPLACE)) {
+    BSONObj metadata;
+    if(!get_metadata(path, metadata)) {
+      return -ENOENT;
+    }
+
+    bool exists = metadata.hasField(attr_name);
+    if((flags & XATTR_CREATE) && exists) {
+      return -EEXIST;
+    } else if((flags & XATTR_REPLACE) && !exists) {
+      return -ENOATTR;
+    }
   }
 
-  LocalGridFile *lgf = open_files[path];
+  // Only metadata.<name> changes; the chunks and the rest of the
+  // document stay as they are
+  bool ok = storage->setMetadata(path, attr_name, string(value, size));
+  metadata_changed(path);
 
-  return lgf->write(buf, nbyte, offset);
+  return ok ? 0 : -ENOENT;
 }
 
-int gridfs_flush(const char* path, struct fuse_file_info *ffi)
+int gridfs_removexattr(const char* path, const char* name)
 {
-  path = fuse_to_mongo_path(path);
+  OpTimer timer(Metrics::OP_REMOVEXATTR);
 
-  if(!ffi->fh) {
-    return 0;
+  if(gridfs_options.readonly) {
+    return -EROFS;
   }
 
-  map<string,LocalGridFile*>::iterator file_iter;
-  file_iter = open_files.find(path);
-  if(file_iter == open_files.end()) {
+  path = fuse_to_mongo_path(path);
+  int err;
+  const char* attr_name = xattr_field(path, name, err);
+  if(!attr_name) {
+    return err;
+  }
+
+  BSONObj metadata;
+  if(!get_metadata(path, metadata)) {
     return -ENOENT;
+  } else if(!metadata.hasField(attr_name)) {
+    return -ENOATTR;
   }
 
-  LocalGridFile *lgf = file_iter->second;
+  bool ok = storage->removeMetadata(path, attr_name);
+  metadata_changed(path);
 
-  if(!lgf->dirty()) {
-    return 0;
-  }
+  return ok ? 0 : -ENOENT;
+}
+
+int gridfs_write(const char* path, const char* buf, size_t nbyte,
+         off_t offset, struct fuse_file_info* ffi)
+{
+  return gridfs_write_handle(get_handle(ffi), buf, nbyte, offset);
+}
 
-  ScopedDbConnection sdc(gridfs_options.host);
-  DBClientBase &client = sdc.conn();
-  GridFS gf(sdc.conn(), gridfs_options.db);
+int gridfs_write_handle(FileHandle* fh, const char* buf, size_t nbyte,
+                        off_t offset)
+{
+  OpTimer timer(Metrics::OP_WRITE);
 
-  if(gf.findFile(path).exists()) {
-    gf.removeFile(path);
+  if(!fh || !fh->writable()) {
+    return -EBADF;
   }
 
-  size_t len = lgf->getLength();
-  char *buf = new char[len];
-  lgf->read(buf, len, 0);
+  int res = fh->append() ? fh->writer()->append(buf, nbyte) :
+    fh->writer()->write(buf, nbyte, offset);
+  if(res > 0) {
+    metrics.add(Metrics::BYTES_WRITTEN, res);
+  }
+  return res;
+}
 
-  gf.storeFile(buf, len, path);
+int gridfs_flush(const char* path, struct fuse_file_info *ffi)
+{
+  return gridfs_flush_handle(get_handle(ffi));
+}
 
-  sdc.done();
+int gridfs_flush_handle(FileHandle* fh)
+{
+  OpTimer timer(Metrics::OP_FLUSH);
+
+  if(!fh || !fh->writable()) {
+    return 0;
+  }
 
-  lgf->flushed();
+  int res = fh->writer()->flush();
+  stat_cache.invalidate(fh->path());
 
-  return 0;
+  return res;
 }
 
 int gridfs_rename(const char* old_path, const char* new_path)
 {
+  OpTimer timer(Metrics::OP_RENAME);
+
   old_path = fuse_to_mongo_path(old_path);
   new_path = fuse_to_mongo_path(new_path);
+  if(is_virtual(old_path) || is_virtual(new_path)) {
+    return -EACCES;
+  } else if(gridfs_options.readonly) {
+    return -EROFS;
+  }
 
-  ScopedDbConnection sdc(gridfs_options.host);
-  DBClientBase &client = sdc.conn();
-
-  string db_name = gridfs_options.db;
+  if(strcmp(old_path, new_path) == 0) {
+    return storage->findFile(old_path).isEmpty() ? -ENOENT : 0;
+  }
 
-  BSONObj file_obj = client.findOne(db_name + ".fs.files",
-                    BSON("filename" << old_path));
+  // Whatever new_path names now is replaced. Its documents go once the
+  // rename is in, so the name never goes missing, and their chunks once
+  // nothing reads them, as for unlink.
+  vector<BSONObj> replaced = storage->findVersions(new_path);
 
-  if(file_obj.isEmpty()) {
+  if(!storage->renameFile(old_path, new_path)) {
     return -ENOENT;
   }
 
-  BSONObjBuilder b;
-  set<string> field_names;
-  file_obj.getFieldNames(field_names);
-
-  for(set<string>::iterator name = field_names.begin();
-    name != field_names.end(); name++)
-  {
-    if(*name != "filename") {
-      b.append(file_obj.getField(*name));
+  for(vector<BSONObj>::iterator i = replaced.begin(); i != replaced.end(); i++) {
+    if(storage->removeFile(*i)) {
+      chunk_gc.collect(*i);
     }
   }
 
-  b << "filename" << new_path;
+  stat_cache.invalidate(old_path);
+  stat_cache.invalidate(new_path);
+  open_files.invalidate(old_path);
+  open_files.invalidate(new_path);
 
-  client.update(db_name + ".fs.files",
-          BSON("_id" << file_obj.getField("_id")), b.obj());
+  return 0;
+}
 
-  sdc.done();
+// Without it open(O_TRUNC) fails with ENOSYS once the file is open.
+// Truncating isn't supported, so it fails the way opening for writing
+// used to.
+int gridfs_truncate(const char* path, off_t size)
+{
+  path = fuse_to_mongo_path(path);
+  if(gridfs_options.readonly && !is_virtual(path)) {
+    return -EROFS;
+  }
 
-  return 0;
+  return -EACCES;
 }
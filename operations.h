@@ -21,13 +21,22 @@
 #define _FILE_OFFSET_BITS 64
 #define FUSE_USE_VERSION 26
 
-// ENOATTR is not blessed by POSIX. Darwin uses 93.
+// ENOATTR is not blessed by POSIX. Linux reports a missing attribute
+// as ENODATA; Darwin uses 93.
 #ifndef ENOATTR
+#ifdef __linux__
+#define ENOATTR ENODATA
+#else
 #define ENOATTR 93
 #endif
+#endif
 
 #include <fuse.h>
 
+void* gridfs_init(struct fuse_conn_info* conn);
+
+void gridfs_destroy(void* data);
+
 int gridfs_getattr(const char *path, struct stat *stbuf);
 
 int gridfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
@@ -44,6 +53,10 @@ int gridfs_read(const char *path, char *buf, size_t size, off_t offset,
 
 int gridfs_unlink(const char* path);
 
+int gridfs_mkdir(const char* path, mode_t mode);
+
+int gridfs_rmdir(const char* path);
+
 int gridfs_listxattr(const char* path, char* list, size_t size);
 
 int gridfs_getxattr(const char* path, const char* name, char* value, size_t size);
@@ -51,6 +64,8 @@ int gridfs_getxattr(const char* path, const char* name, char* value, size_t size
 int gridfs_setxattr(const char* path, const char* name, const char* value,
           size_t size, int flags);
 
+int gridfs_removexattr(const char* path, const char* name);
+
 int gridfs_write(const char* path, const char* buf, size_t nbyte,
          off_t offset, struct fuse_file_info* ffi);
 
@@ -58,4 +73,19 @@ int gridfs_flush(const char* path, struct fuse_file_info* ffi);
 
 int gridfs_rename(const char* old_path, const char* new_path);
 
+int gridfs_truncate(const char* path, off_t size);
+
+// The parts of read, write, flush and release that only need the open
+// handle, shared with the low level backend which has no path for them
+class FileHandle;
+
+int gridfs_read_handle(FileHandle* fh, char *buf, size_t size, off_t offset);
+
+int gridfs_write_handle(FileHandle* fh, const char* buf, size_t nbyte,
+                        off_t offset);
+
+int gridfs_flush_handle(FileHandle* fh);
+
+void gridfs_release_handle(FileHandle* fh);
+
 #endif
@@ -26,6 +26,27 @@ struct fuse_opt gridfs_opts[] =
 {
   GRIDFS_OPT_KEY("--host=%s", host, 0),
   GRIDFS_OPT_KEY("--db=%s", db, 0),
+  GRIDFS_OPT_KEY("--cache_size=%u", cache_size, 0),
+  GRIDFS_OPT_KEY("--readahead=%u", readahead, 0),
+  GRIDFS_OPT_KEY("--readahead_threads=%u", readahead_threads, 0),
+  GRIDFS_OPT_KEY("--attr_timeout=%u", attr_timeout, 0),
+  GRIDFS_OPT_KEY("--negative_timeout=%u", negative_timeout, 0),
+  GRIDFS_OPT_KEY("--upload_threads=%u", upload_threads, 0),
+  GRIDFS_OPT_KEY("--upload_inflight=%u", upload_inflight, 0),
+  GRIDFS_OPT_KEY("--write_buffer=%u", write_buffer, 0),
+  GRIDFS_OPT_KEY("--spill_dir=%s", spill_dir, 0),
+  GRIDFS_OPT_KEY("--buffer_pool=%u", buffer_pool, 0),
+  GRIDFS_OPT_KEY("--lowlevel", lowlevel, 1),
+  GRIDFS_OPT_KEY("--readonly", readonly, 1),
+  GRIDFS_OPT_KEY("--poll=%u", poll, 0),
+  GRIDFS_OPT_KEY("--backend=%s", backend, 0),
+  GRIDFS_OPT_KEY("--latency=%u", latency, 0),
+  GRIDFS_OPT_KEY("--disk_cache=%s", disk_cache, 0),
+  GRIDFS_OPT_KEY("--disk_cache_size=%u", disk_cache_size, 0),
+  GRIDFS_OPT_KEY("--pool_size=%u", pool_size, 0),
+  GRIDFS_OPT_KEY("--health_check=%u", health_check, 0),
+  GRIDFS_OPT_KEY("--reconnect_tries=%u", reconnect_tries, 0),
+  GRIDFS_OPT_KEY("--reconnect_delay=%u", reconnect_delay, 0),
   FUSE_OPT_KEY("-v", KEY_VERSION),
   FUSE_OPT_KEY("--version", KEY_VERSION),
   FUSE_OPT_KEY("-h", KEY_HELP),
@@ -55,6 +76,27 @@ void print_help()
   cout << endl << "general options:" << endl;
   cout << "\t--db=[dbname]\t\twhich mongo database to use" << endl;
   cout << "\t--host=[hostname]\thostname of your mongodb server" << endl;
+  cout << "\t--cache_size=[MB]\tmemory for cached chunks (default 64)" << endl;
+  cout << "\t--readahead=[chunks]\tmax chunks to prefetch, 0 disables (default 8)" << endl;
+  cout << "\t--readahead_threads=[n]\tprefetch threads (default 4)" << endl;
+  cout << "\t--attr_timeout=[s]\tseconds to cache file attributes (default 1, --poll or a day with --readonly)" << endl;
+  cout << "\t--negative_timeout=[s]\tseconds to cache missing files (default 1, --poll or a day with --readonly)" << endl;
+  cout << "\t--upload_threads=[n]\tthreads uploading chunks, each with its own connection (default 4)" << endl;
+  cout << "\t--upload_inflight=[n]\tchunk uploads in flight per file (default 8)" << endl;
+  cout << "\t--write_buffer=[MB]\tmemory for unflushed writes before spilling to disk (default unlimited)" << endl;
+  cout << "\t--spill_dir=[dir]\twhere to spill write buffers (default /tmp)" << endl;
+  cout << "\t--buffer_pool=[MB]\tfree write buffers kept for reuse (default 16)" << endl;
+  cout << "\t--disk_cache=[dir]\tkeep chunks in dir across mounts (default off)" << endl;
+  cout << "\t--disk_cache_size=[MB]\tdisk for cached chunks (default 1024)" << endl;
+  cout << "\t--pool_size=[n]\tidle connections kept open to mongod (default 8)" << endl;
+  cout << "\t--health_check=[s]\tping connections idle this long before reuse, 0 never (default 60)" << endl;
+  cout << "\t--reconnect_tries=[n]\tretries when mongod can't be reached (default 3)" << endl;
+  cout << "\t--reconnect_delay=[ms]\tdelay before the first retry, doubling after (default 100)" << endl;
+  cout << "\t--readonly\t\tserve a snapshot of fs.files taken at mount, for files that never change" << endl;
+  cout << "\t--poll=[s]\t\trefresh the --readonly snapshot this often, 0 never (default 0)" << endl;
+  cout << "\t--lowlevel\t\tuse the FUSE low level API with inode numbers" << endl;
+  cout << "\t--backend=[name]\tmongo, or memory to benchmark without a server (default mongo)" << endl;
+  cout << "\t--latency=[ms]\t\tdelay added to every request by the memory backend (default 0)" << endl;
   cout << "\t-h, --help\t\tprint help" << endl;
   cout << "\t-v, --version\t\tprint version" << endl;
   cout << endl << "FUSE options: " << endl;
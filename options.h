@@ -24,6 +24,27 @@
 struct gridfs_options {
   const char* host;
   const char* db;
+  unsigned int cache_size;
+  unsigned int readahead;
+  unsigned int readahead_threads;
+  unsigned int attr_timeout;
+  unsigned int negative_timeout;
+  unsigned int upload_threads;
+  unsigned int upload_inflight;
+  unsigned int write_buffer;
+  const char* spill_dir;
+  unsigned int buffer_pool;
+  int lowlevel;
+  const char* backend;
+  unsigned int latency;
+  const char* disk_cache;
+  unsigned int disk_cache_size;
+  unsigned int pool_size;
+  unsigned int health_check;
+  unsigned int reconnect_tries;
+  unsigned int reconnect_delay;
+  int readonly;
+  unsigned int poll;
 };
 
 extern gridfs_options gridfs_options;
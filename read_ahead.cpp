@@ -0,0 +1,140 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "read_ahead.h"
+#include "file_handle.h"
+#include "chunk_cache.h"
+#include "disk_cache.h"
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace mongo;
+
+ReadAhead read_ahead;
+
+void ReadAhead::start(int threads, int maxWindow)
+{
+  _maxWindow = maxWindow;
+  if(_maxWindow > 0 && threads > 0) {
+    _queue.start(threads);
+  }
+}
+
+void ReadAhead::stop()
+{
+  _queue.stop();
+}
+
+void ReadAhead::onRead(FileHandle& fh, off_t offset, size_t size)
+{
+  if(_maxWindow <= 0 || !fh.exists()) {
+    return;
+  }
+
+  int chunk_size = fh.getChunkSize();
+  int first, last;
+  {
+    ReadAheadState& state = fh.readAheadState();
+    boost::mutex::scoped_lock lock(state.mutex);
+
+    if(offset == state.nextOffset) {
+      state.window = max(1, min(state.window * 2, _maxWindow));
+    } else {
+      state.window = 0;
+      state.scheduledTo = -1;
+    }
+    state.nextOffset = offset + size;
+
+    if(!state.window) {
+      return;
+    }
+
+    int current = (offset + size - 1) / chunk_size;
+    first = max(current + 1, state.scheduledTo + 1);
+    last = min(current + state.window, fh.getNumChunks() - 1);
+    if(first > last) {
+      return;
+    }
+  }
+
+  // Queue one range fetch per run of chunks that are neither cached, in
+  // memory or on disk, nor already on their way
+  int n = first;
+  while(n <= last) {
+    int run_end = n;
+    {
+      boost::mutex::scoped_lock lock(_inflightMutex);
+      while(run_end <= last &&
+            !chunk_cache.contains(fh.cacheId(), run_end) &&
+            !disk_cache.contains(fh.cacheId(), fh.version(), run_end) &&
+            _inflight.insert(make_pair(fh.cacheId(), run_end)).second) {
+        run_end++;
+      }
+    }
+
+    if(run_end > n &&
+       !_queue.push(boost::bind(&ReadAhead::fetch, this, fh.file(),
+                                n, run_end))) {
+      {
+        boost::mutex::scoped_lock lock(_inflightMutex);
+        for(int i = n; i < run_end; i++) {
+          _inflight.erase(make_pair(fh.cacheId(), i));
+        }
+      }
+
+      // The next read tries again from the first chunk that wasn't queued
+      scheduled(fh, n - 1);
+      return;
+    }
+
+    n = run_end + 1;
+  }
+
+  scheduled(fh, last);
+}
+
+// Chunks up to n are cached or on their way
+void ReadAhead::scheduled(FileHandle& fh, int n)
+{
+  ReadAheadState& state = fh.readAheadState();
+  boost::mutex::scoped_lock lock(state.mutex);
+  state.scheduledTo = max(state.scheduledTo, n);
+}
+
+void ReadAhead::fetch(BSONObj file, int first, int last)
+{
+  string cache_id = file["_id"].toString(false);
+
+  try {
+    fetch_chunks(file, first, last);
+  } catch(...) {
+    finished(cache_id, first, last);
+    throw;
+  }
+
+  finished(cache_id, first, last);
+}
+
+void ReadAhead::finished(const string& cache_id, int first, int last)
+{
+  boost::mutex::scoped_lock lock(_inflightMutex);
+  for(int n = first; n < last; n++) {
+    _inflight.erase(make_pair(cache_id, n));
+  }
+}
@@ -0,0 +1,69 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __READ_AHEAD_H
+#define __READ_AHEAD_H
+
+#include "work_queue.h"
+#include <set>
+#include <string>
+#include <sys/types.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <mongo/client/dbclient.h>
+
+class FileHandle;
+
+// Per handle sequential access tracking
+struct ReadAheadState {
+  ReadAheadState() : nextOffset(0), window(0), scheduledTo(-1) {}
+
+  boost::mutex mutex;
+  off_t nextOffset;
+  int window;
+  int scheduledTo;
+};
+
+// Watches the reads made through each handle and, once they look
+// sequential, fetches the following chunks into the chunk cache on a
+// background pool. The window doubles with every sequential read up to
+// the --readahead limit and collapses on a seek.
+class ReadAhead {
+public:
+  ReadAhead() : _maxWindow(0), _queue(256) {}
+
+  void start(int threads, int maxWindow);
+  void stop();
+
+  void onRead(FileHandle& fh, off_t offset, size_t size);
+
+private:
+  void fetch(mongo::BSONObj file, int first, int last);
+  void scheduled(FileHandle& fh, int n);
+  void finished(const std::string& cache_id, int first, int last);
+
+  int _maxWindow;
+  WorkQueue _queue;
+
+  boost::mutex _inflightMutex;
+  std::set<std::pair<std::string, int> > _inflight;
+};
+
+extern ReadAhead read_ahead;
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "snapshot_storage.h"
+#include "open_file_table.h"
+#include "stat_cache.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace mongo;
+
+SnapshotStorage* snapshot = NULL;
+
+SnapshotStorage::~SnapshotStorage()
+{
+  close();
+  delete _backend;
+}
+
+// Everything the handlers look at, without the rest of what clients may
+// have stored on each document. metadata backs the xattrs.
+BSONObj SnapshotStorage::fields()
+{
+  return BSON("filename" << 1 << "length" << 1 << "chunkSize" << 1
+              << "uploadDate" << 1 << "md5" << 1 << "metadata" << 1);
+}
+
+void SnapshotStorage::prepare()
+{
+  _backend->prepare();
+
+  double start = monotonic_time();
+  BSONObj projection = fields();
+  _backend->listFiles("", "", &projection,
+                      boost::bind(&SnapshotStorage::load, this, _1));
+  _last = BSONObj();
+  _loadSeconds = monotonic_time() - start;
+
+  size_t files = _table.size();
+  cerr << "gridfs-fuse: loaded " << files << " files in " << _loadSeconds
+       << "s, " << (files ? _table.bytes() / files : 0) << " bytes per entry"
+       << endl;
+
+  if(_pollInterval) {
+    _thread = boost::thread(boost::bind(&SnapshotStorage::poller, this));
+  }
+}
+
+void SnapshotStorage::close()
+{
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _stopping = true;
+    _cond.notify_all();
+  }
+  if(_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+// Files come in filename order; of several versions of a name only the
+// newest is kept
+bool SnapshotStorage::load(const BSONObj& file)
+{
+  unsigned long long upload_date = file["uploadDate"].date();
+  _watermark = max(_watermark, upload_date);
+
+  if(!_last.isEmpty() &&
+     strcmp(_last.getStringField("filename"),
+            file.getStringField("filename")) == 0 &&
+     upload_date <= (unsigned long long)_last["uploadDate"].date()) {
+    return true;
+  }
+
+  _table.put(file);
+  _last = file.getOwned();
+  return true;
+}
+
+// Applies a document the backend reported as new or changed, unless the
+// table already has it or something newer under its name
+bool SnapshotStorage::update(const BSONObj& file)
+{
+  unsigned long long upload_date = file["uploadDate"].date();
+  _watermark = max(_watermark, upload_date);
+
+  string filename = file.getStringField("filename");
+  int i = _table.position(filename);
+  if(i != -1) {
+    unsigned long long current = _table.find(filename)["uploadDate"].date();
+    if(upload_date < current ||
+       (upload_date == current && _table.sameId(i, file["_id"]))) {
+      return true;
+    }
+  }
+
+  _table.put(file);
+  changed(filename);
+  return true;
+}
+
+void SnapshotStorage::changed(const string& filename)
+{
+  stat_cache.invalidate(filename);
+  open_files.invalidate(filename);
+}
+
+void SnapshotStorage::poller()
+{
+  for(;;) {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      boost::system_time until = boost::get_system_time() +
+        boost::posix_time::seconds(_pollInterval);
+      while(!_stopping && _cond.timed_wait(lock, until)) {
+      }
+      if(_stopping) {
+        return;
+      }
+      _polls++;
+    }
+
+    try {
+      poll();
+    } catch(DBException& e) {
+      cerr << "gridfs-fuse: refreshing the snapshot failed: " << e.what()
+           << endl;
+    }
+  }
+}
+
+void SnapshotStorage::poll()
+{
+  BSONObj projection = fields();
+  unsigned long long since = _watermark > CLOCK_SKEW ?
+    _watermark - CLOCK_SKEW : 0;
+  _backend->listUpdated(since, &projection,
+                        boost::bind(&SnapshotStorage::update, this, _1));
+
+  if(polls() % SCAN_EVERY == 0) {
+    scan();
+  }
+}
+
+namespace {
+  // Marks which entries of the table the backend still has, and notes
+  // names whose _id no longer matches or that the table is missing
+  class Scanner {
+  public:
+    Scanner(const FileTable& table, vector<bool>& seen,
+            vector<string>& fetch) :
+      _table(table), _seen(seen), _fetch(fetch) {}
+
+    bool operator()(const BSONObj& file) {
+      string filename = file.getStringField("filename");
+      int i = _table.position(filename);
+      if(i == -1) {
+        _fetch.push_back(filename);
+      } else if(!_seen[i]) {
+        _seen[i] = true;
+        if(!_table.sameId(i, file["_id"])) {
+          _fetch.push_back(filename);
+        }
+      }
+      return true;
+    }
+
+  private:
+    const FileTable& _table;
+    vector<bool>& _seen;
+    vector<string>& _fetch;
+  };
+}
+
+// Only the poller changes the table, so positions hold for the scan
+void SnapshotStorage::scan()
+{
+  vector<bool> seen(_table.size(), false);
+  vector<string> fetch;
+
+  BSONObj projection = BSON("_id" << 1 << "filename" << 1);
+  _backend->listFiles("", "", &projection, Scanner(_table, seen, fetch));
+
+  vector<string> removed;
+  for(size_t i = 0; i < seen.size(); i++) {
+    if(!seen[i]) {
+      removed.push_back(_table.filenameAt(i));
+    }
+  }
+  for(vector<string>::iterator i = removed.begin(); i != removed.end(); i++) {
+    _table.remove(*i);
+    changed(*i);
+  }
+
+  BSONObj projection_all = fields();
+  for(vector<string>::iterator i = fetch.begin(); i != fetch.end(); i++) {
+    BSONObj file = _backend->findFile(*i, &projection_all);
+    if(!file.isEmpty()) {
+      update(file);
+    }
+  }
+}
+
+unsigned long long SnapshotStorage::polls()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _polls;
+}
+
+BSONObj SnapshotStorage::findFile(const string& filename, const BSONObj* fields)
+{
+  return _table.find(filename);
+}
+
+void SnapshotStorage::listFiles(const string& lower, const string& upper,
+                                const BSONObj* fields, const FileSink& sink,
+                                int limit)
+{
+  _table.list(lower, upper, sink, limit);
+}
+
+void SnapshotStorage::listUpdated(unsigned long long since,
+                                  const BSONObj* fields, const FileSink& sink)
+{
+  _backend->listUpdated(since, fields, sink);
+}
+
+vector<BSONObj> SnapshotStorage::findVersions(const string& filename)
+{
+  vector<BSONObj> ids;
+  BSONObj file = findFile(filename);
+  if(!file.isEmpty()) {
+    ids.push_back(BSON("_id" << file["_id"]));
+  }
+  return ids;
+}
+
+bool SnapshotStorage::putFile(const BSONObj& id, const BSONObj& fields)
+{
+  return false;
+}
+
+bool SnapshotStorage::removeFile(const BSONObj& id)
+{
+  return false;
+}
+
+bool SnapshotStorage::updateFile(const BSONObj& id, const BSONObj& fields)
+{
+  return false;
+}
+
+bool SnapshotStorage::renameFile(const string& oldName, const string& newName)
+{
+  return false;
+}
+
+bool SnapshotStorage::setMetadata(const string& filename, const string& name,
+                                  const string& value)
+{
+  return false;
+}
+
+bool SnapshotStorage::removeMetadata(const string& filename, const string& name)
+{
+  return false;
+}
+
+int SnapshotStorage::fetchChunks(const BSONObj& id, int first, int last,
+                                 const ChunkDataSink& sink)
+{
+  return _backend->fetchChunks(id, first, last, sink);
+}
+
+bool SnapshotStorage::putChunk(const BSONObj& id, int n, const char* data,
+                               int len)
+{
+  return false;
+}
+
+bool SnapshotStorage::removeChunks(const BSONObj& id)
+{
+  return false;
+}
+
+string SnapshotStorage::fileMD5(const BSONObj& id)
+{
+  return "";
+}
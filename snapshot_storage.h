@@ -0,0 +1,111 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __SNAPSHOT_STORAGE_H
+#define __SNAPSHOT_STORAGE_H
+
+#include "storage.h"
+#include "file_table.h"
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// Backs --readonly mounts. fs.files is read with one projected scan when
+// the filesystem starts and every lookup and listing after that is
+// answered from the copy, so only chunk reads reach the backend. Writes
+// fail.
+//
+// With a poll interval the copy is kept up to date in the background:
+// each poll asks for files uploaded since the last one, and every
+// SCAN_EVERY polls a scan of just _id and filename finds files that were
+// removed or renamed.
+class SnapshotStorage : public Storage {
+public:
+  // Takes ownership of backend. A poll interval of 0 never refreshes.
+  SnapshotStorage(Storage* backend, unsigned pollInterval = 0) :
+    _backend(backend), _pollInterval(pollInterval), _stopping(false),
+    _watermark(0), _loadSeconds(0), _polls(0) {}
+  ~SnapshotStorage();
+
+  // Loads the snapshot and starts polling
+  void prepare();
+  void close();
+
+  mongo::BSONObj findFile(const std::string& filename,
+                          const mongo::BSONObj* fields = NULL);
+  void listFiles(const std::string& lower, const std::string& upper,
+                 const mongo::BSONObj* fields, const FileSink& sink,
+                 int limit = 0);
+  void listUpdated(unsigned long long since, const mongo::BSONObj* fields,
+                   const FileSink& sink);
+  std::vector<mongo::BSONObj> findVersions(const std::string& filename);
+
+  bool putFile(const mongo::BSONObj& id, const mongo::BSONObj& fields);
+  bool removeFile(const mongo::BSONObj& id);
+  bool updateFile(const mongo::BSONObj& id, const mongo::BSONObj& fields);
+  bool renameFile(const std::string& oldName, const std::string& newName);
+  bool setMetadata(const std::string& filename, const std::string& name,
+                   const std::string& value);
+  bool removeMetadata(const std::string& filename, const std::string& name);
+
+  int fetchChunks(const mongo::BSONObj& id, int first, int last,
+                  const ChunkDataSink& sink);
+  bool putChunk(const mongo::BSONObj& id, int n, const char* data, int len);
+  bool removeChunks(const mongo::BSONObj& id);
+  std::string fileMD5(const mongo::BSONObj& id);
+
+  size_t files() const { return _table.size(); }
+  size_t bytes() const { return _table.bytes(); }
+  double loadSeconds() const { return _loadSeconds; }
+  unsigned long long polls();
+
+private:
+  static const int SCAN_EVERY = 10;
+  // How far before the newest uploadDate seen each poll looks, for
+  // clients whose clocks run behind
+  static const unsigned long long CLOCK_SKEW = 60 * 1000;
+
+  static mongo::BSONObj fields();
+  bool load(const mongo::BSONObj& file);
+  bool update(const mongo::BSONObj& file);
+  void poller();
+  void poll();
+  void scan();
+  void changed(const std::string& filename);
+
+  Storage* _backend;
+  FileTable _table;
+  unsigned _pollInterval;
+
+  boost::thread _thread;
+  boost::mutex _mutex;
+  boost::condition_variable _cond;
+  bool _stopping;
+
+  // Only touched by prepare and then the poller
+  unsigned long long _watermark;
+  double _loadSeconds;
+  mongo::BSONObj _last;
+  unsigned long long _polls;
+};
+
+// The backend of a --readonly mount, NULL otherwise
+extern SnapshotStorage* snapshot;
+
+#endif
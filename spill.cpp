@@ -0,0 +1,160 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spill.h"
+#include "chunk_pool.h"
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+using namespace std;
+
+MemoryBudget write_memory;
+
+string SpillFile::_dir = "/tmp";
+
+void MemoryBudget::setLimit(size_t limit)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _limit = limit;
+}
+
+bool MemoryBudget::reserve(size_t bytes)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  if(_limit && _used + bytes > _limit) {
+    return false;
+  }
+  _used += bytes;
+  return true;
+}
+
+void MemoryBudget::charge(size_t bytes)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _used += bytes;
+}
+
+void MemoryBudget::release(size_t bytes)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _used -= bytes;
+}
+
+size_t MemoryBudget::used()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  return _used;
+}
+
+SpillFile::SpillFile(int chunkSize) :
+  _fd(-1), _chunkSize(chunkSize), _slots(0)
+{
+  off_t page = sysconf(_SC_PAGESIZE);
+  _stride = (chunkSize + page - 1) / page * page;
+
+  string path = _dir + "/gridfs-spill.XXXXXX";
+  vector<char> templ(path.begin(), path.end());
+  templ.push_back('\0');
+
+  _fd = mkstemp(&templ[0]);
+  if(_fd != -1) {
+    unlink(&templ[0]);
+  }
+}
+
+SpillFile::~SpillFile()
+{
+  for(map<char*, int>::iterator i = _mapped.begin(); i != _mapped.end(); i++) {
+    munmap(i->first, _chunkSize);
+  }
+
+  if(_fd != -1) {
+    close(_fd);
+  }
+}
+
+char* SpillFile::mapChunk()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+
+  if(_fd == -1) {
+    return NULL;
+  }
+
+  int slot;
+  bool reused = !_free.empty();
+  if(reused) {
+    slot = _free.back();
+    _free.pop_back();
+  } else {
+    slot = _slots;
+    if(ftruncate(_fd, (slot + 1) * _stride) != 0) {
+      return NULL;
+    }
+    _slots++;
+  }
+
+  void* addr = mmap(NULL, _chunkSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    _fd, slot * _stride);
+  if(addr == MAP_FAILED) {
+    _free.push_back(slot);
+    return NULL;
+  }
+
+  char* chunk = (char*)addr;
+  // Fresh slots are holes in a sparse file and already read as zeros
+  if(reused) {
+    memset(chunk, 0, _chunkSize);
+  }
+
+  _mapped[chunk] = slot;
+  return chunk;
+}
+
+void SpillFile::unmapChunk(char* chunk)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+
+  map<char*, int>::iterator i = _mapped.find(chunk);
+  if(i == _mapped.end()) {
+    return;
+  }
+
+  munmap(chunk, _chunkSize);
+  _free.push_back(i->second);
+  _mapped.erase(i);
+}
+
+void free_chunk(ChunkBuffer& chunk, int chunkSize)
+{
+  if(!chunk.data) {
+    return;
+  }
+
+  if(chunk.spill) {
+    chunk.spill->unmapChunk(chunk.data);
+    chunk.spill.reset();
+  } else {
+    chunk_pool.deallocate(chunk.data, chunkSize);
+    write_memory.release(chunkSize);
+  }
+
+  chunk.data = NULL;
+}
@@ -0,0 +1,86 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SPILL_H
+#define __SPILL_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+// Bytes of write buffers kept on the heap across every open file. A
+// limit of 0 means no limit.
+class MemoryBudget {
+public:
+  MemoryBudget() : _limit(0), _used(0) {}
+
+  void setLimit(size_t limit);
+  bool reserve(size_t bytes);
+  // Counts bytes against the budget even if that goes over the limit
+  void charge(size_t bytes);
+  void release(size_t bytes);
+  size_t used();
+
+private:
+  boost::mutex _mutex;
+  size_t _limit, _used;
+};
+
+extern MemoryBudget write_memory;
+
+// An unlinked, sparse temporary file that chunk sized buffers are mapped
+// from once the heap budget is used up. The kernel can write those
+// pages back to disk instead of keeping them in RAM.
+class SpillFile {
+public:
+  SpillFile(int chunkSize);
+  ~SpillFile();
+
+  static void setDirectory(const std::string& dir) { _dir = dir; }
+
+  // Returns a zeroed chunk, or NULL if it couldn't be mapped
+  char* mapChunk();
+  void unmapChunk(char* chunk);
+
+private:
+  static std::string _dir;
+
+  int _fd;
+  int _chunkSize;
+  // Slots are page aligned so each can be mapped on its own
+  off_t _stride;
+  int _slots;
+  std::vector<int> _free;
+  std::map<char*, int> _mapped;
+  boost::mutex _mutex;
+};
+
+// A chunk buffer that came either from the heap or from a spill file
+struct ChunkBuffer {
+  ChunkBuffer() : data(NULL) {}
+
+  char* data;
+  boost::shared_ptr<SpillFile> spill;
+};
+
+void free_chunk(ChunkBuffer& chunk, int chunkSize);
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stat_cache.h"
+#include "utils.h"
+
+using namespace std;
+using namespace mongo;
+
+StatCache stat_cache;
+
+void StatCache::setTimeouts(double timeout, double negativeTimeout)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _timeout = timeout;
+  _negativeTimeout = negativeTimeout;
+  _entries.clear();
+}
+
+bool StatCache::get(const string& path, struct stat* st, bool& exists)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+
+  map<string, Entry>::iterator i = _entries.find(path);
+  if(i == _entries.end()) {
+    return false;
+  }
+
+  if(i->second.expires < monotonic_time()) {
+    _entries.erase(i);
+    return false;
+  }
+
+  exists = i->second.exists;
+  if(exists) {
+    *st = i->second.st;
+  }
+  return true;
+}
+
+bool StatCache::getMetadata(const string& path, BSONObj& metadata)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+
+  map<string, Entry>::iterator i = _entries.find(path);
+  if(i == _entries.end() || !i->second.hasMetadata ||
+     i->second.expires < monotonic_time()) {
+    return false;
+  }
+
+  metadata = i->second.metadata;
+  return true;
+}
+
+void StatCache::put(const string& path, const struct stat& st,
+                    const BSONObj* metadata)
+{
+  if(_timeout <= 0) {
+    return;
+  }
+
+  Entry entry;
+  entry.expires = monotonic_time() + _timeout;
+  entry.exists = true;
+  entry.st = st;
+  entry.hasMetadata = metadata != NULL;
+  if(metadata) {
+    entry.metadata = metadata->getOwned();
+  }
+  insert(path, entry);
+}
+
+void StatCache::putNegative(const string& path)
+{
+  if(_negativeTimeout <= 0) {
+    return;
+  }
+
+  Entry entry;
+  entry.expires = monotonic_time() + _negativeTimeout;
+  entry.exists = false;
+  entry.hasMetadata = false;
+  insert(path, entry);
+}
+
+void StatCache::invalidate(const string& path)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _entries.erase(path);
+}
+
+void StatCache::insert(const string& path, const Entry& entry)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+
+  if(_entries.size() >= _maxEntries) {
+    double now = monotonic_time();
+    for(map<string, Entry>::iterator i = _entries.begin();
+        i != _entries.end();) {
+      if(i->second.expires < now) {
+        _entries.erase(i++);
+      } else {
+        i++;
+      }
+    }
+
+    if(_entries.size() >= _maxEntries) {
+      _entries.clear();
+    }
+  }
+
+  _entries[path] = entry;
+}
@@ -0,0 +1,71 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STAT_CACHE_H
+#define __STAT_CACHE_H
+
+#include <map>
+#include <string>
+#include <sys/stat.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <mongo/client/dbclient.h>
+
+// Short lived cache of getattr results. Negative entries remember paths
+// that didn't exist so repeated probes for missing files stay local.
+// An entry can also carry the file's metadata document, which backs
+// its xattrs, so listing them and reading each one costs one query.
+class StatCache {
+public:
+  StatCache() : _timeout(0), _negativeTimeout(0), _maxEntries(100000) {}
+
+  void setTimeouts(double timeout, double negativeTimeout);
+
+  // Returns true on a fresh hit. exists is set to false for a negative
+  // entry, in which case st is left untouched.
+  bool get(const std::string& path, struct stat* st, bool& exists);
+
+  // Like get, for the metadata stored with an entry. False if it was
+  // put without any.
+  bool getMetadata(const std::string& path, mongo::BSONObj& metadata);
+
+  void put(const std::string& path, const struct stat& st,
+           const mongo::BSONObj* metadata = NULL);
+  void putNegative(const std::string& path);
+  void invalidate(const std::string& path);
+
+private:
+  struct Entry {
+    double expires;
+    bool exists;
+    struct stat st;
+    bool hasMetadata;
+    mongo::BSONObj metadata;
+  };
+
+  void insert(const std::string& path, const Entry& entry);
+
+  double _timeout, _negativeTimeout;
+  size_t _maxEntries;
+  boost::mutex _mutex;
+  std::map<std::string, Entry> _entries;
+};
+
+extern StatCache stat_cache;
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "storage.h"
+#include "mongo_storage.h"
+#include "memory_storage.h"
+#include "options.h"
+
+using namespace std;
+
+Storage* storage = NULL;
+
+Storage* make_storage(const string& name)
+{
+  if(name == "mongo") {
+    return new MongoStorage();
+  } else if(name == "memory") {
+    return new MemoryStorage(gridfs_options.latency / 1000.0);
+  }
+  return NULL;
+}
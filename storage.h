@@ -0,0 +1,105 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STORAGE_H
+#define __STORAGE_H
+
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <mongo/client/dbclient.h>
+
+// Everything the filesystem reads from or writes to GridFS. Files are
+// named by { _id: ... } objects since an _id can be of any type. Each
+// call is one request to the server, give or take a cursor's batches.
+class Storage {
+public:
+  // Return false to stop a listing
+  typedef boost::function<bool (const mongo::BSONObj&)> FileSink;
+  typedef boost::function<void (int, const char*, int)> ChunkDataSink;
+
+  virtual ~Storage() {}
+
+  // Called once from gridfs_init
+  virtual void prepare() {}
+  // Called once from gridfs_destroy
+  virtual void close() {}
+
+  // The newest fs.files document named filename, or an empty object.
+  // fields is a projection the backend may apply.
+  virtual mongo::BSONObj findFile(const std::string& filename,
+                                  const mongo::BSONObj* fields = NULL) = 0;
+
+  // fs.files documents with lower <= filename < upper in filename
+  // order, at most limit of them unless it's 0. An empty upper means no
+  // upper bound.
+  virtual void listFiles(const std::string& lower, const std::string& upper,
+                         const mongo::BSONObj* fields, const FileSink& sink,
+                         int limit = 0) = 0;
+
+  // fs.files documents with an uploadDate at or after since, in
+  // milliseconds, in no particular order
+  virtual void listUpdated(unsigned long long since,
+                           const mongo::BSONObj* fields,
+                           const FileSink& sink) = 0;
+
+  // The _id of every fs.files document named filename
+  virtual std::vector<mongo::BSONObj>
+    findVersions(const std::string& filename) = 0;
+
+  // Sets fields on the fs.files document id, creating it if needed.
+  // The writes return false unless the server acknowledged them.
+  virtual bool putFile(const mongo::BSONObj& id,
+                       const mongo::BSONObj& fields) = 0;
+  virtual bool removeFile(const mongo::BSONObj& id) = 0;
+  // Like putFile, but false rather than creating it if there's no
+  // document id
+  virtual bool updateFile(const mongo::BSONObj& id,
+                          const mongo::BSONObj& fields) = 0;
+  // Renames the newest version of oldName. False if there isn't one.
+  virtual bool renameFile(const std::string& oldName,
+                          const std::string& newName) = 0;
+  // Sets or removes metadata.<name> on the newest version of filename,
+  // leaving the rest of the document and its chunks alone. False if
+  // there isn't one.
+  virtual bool setMetadata(const std::string& filename,
+                           const std::string& name,
+                           const std::string& value) = 0;
+  virtual bool removeMetadata(const std::string& filename,
+                              const std::string& name) = 0;
+
+  // Hands chunks [first, last) of file id to sink in order. Returns the
+  // number of chunks fetched.
+  virtual int fetchChunks(const mongo::BSONObj& id, int first, int last,
+                          const ChunkDataSink& sink) = 0;
+  virtual bool putChunk(const mongo::BSONObj& id, int n,
+                        const char* data, int len) = 0;
+  virtual bool removeChunks(const mongo::BSONObj& id) = 0;
+
+  // Hex MD5 of file id's chunks, hashed where they're stored. Empty if
+  // it couldn't be worked out.
+  virtual std::string fileMD5(const mongo::BSONObj& id) = 0;
+};
+
+// Backend by name, "mongo" or "memory". NULL if there's no such backend.
+Storage* make_storage(const std::string& name);
+
+extern Storage* storage;
+
+#endif
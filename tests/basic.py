@@ -4,31 +4,87 @@ import unittest
 import os
 import subprocess
 import time
-import glob
 import stat
-
-class BasicGridfsFUSETestCase(unittest.TestCase):
+import errno
+import ctypes
+import ctypes.util
+import shutil
+import tempfile
+
+# The xattr calls, which Python 2's os module doesn't have
+libc = ctypes.CDLL(ctypes.util.find_library('c'), use_errno=True)
+XATTR_CREATE = 1
+XATTR_REPLACE = 2
+
+def check_xattr(res):
+    if res < 0:
+        err = ctypes.get_errno()
+        raise OSError(err, os.strerror(err))
+    return res
+
+def setxattr(path, name, value, flags=0):
+    check_xattr(libc.setxattr(path, name, value, len(value), flags))
+
+def getxattr(path, name):
+    size = check_xattr(libc.getxattr(path, name, None, 0))
+    buf = ctypes.create_string_buffer(size)
+    size = check_xattr(libc.getxattr(path, name, buf, size))
+    return buf.raw[:size]
+
+def listxattr(path):
+    size = check_xattr(libc.listxattr(path, None, 0))
+    buf = ctypes.create_string_buffer(size)
+    size = check_xattr(libc.listxattr(path, buf, size))
+    return sorted(name for name in buf.raw[:size].split('\0') if name)
+
+def removexattr(path, name):
+    check_xattr(libc.removexattr(path, name))
+
+class MountTestCase(unittest.TestCase):
+    # Extra mount_gridfs options for the test case's mount
+    options = []
 
     def setUp(self):
         self.mount = os.path.join(os.path.dirname(os.path.abspath(__file__)),
                                   'mount')
         os.mkdir('tests/mount')
-        subprocess.check_call(['./mount_gridfs', '--db=gridfstest',
-                               self.mount])
+        self.mount_gridfs(self.options)
+
+    def tearDown(self):
+        for root, dirs, files in os.walk(self.mount):
+            dirs[:] = [d for d in dirs if not d.startswith('.')]
+            for filename in files:
+                os.remove(os.path.join(root, filename))
+
+        self.unmount_gridfs()
+        os.rmdir(self.mount)
+
+    def mount_gridfs(self, options):
+        subprocess.check_call(['./mount_gridfs', '--db=gridfstest'] +
+                              options + [self.mount])
 
         # wait for mount to complete
         time.sleep(1)
 
-    def tearDown(self):
-        for filename in glob.iglob(os.path.join(self.mount, '*')):
-            os.remove(filename)
-
+    def unmount_gridfs(self):
         if os.sys.platform == 'linux2':
             subprocess.check_call(['fusermount', '-u', self.mount])
         else:
             subprocess.check_call(['umount', self.mount])
 
-        os.rmdir(self.mount)
+    # The unlabelled samples in .gridfs/stats, by name
+    def stats(self):
+        with open(os.path.join(self.mount, '.gridfs/stats'), 'r') as r:
+            lines = r.read().splitlines()
+
+        samples = {}
+        for line in lines:
+            if line and not line.startswith('#') and '{' not in line:
+                name, value = line.rsplit(' ', 1)
+                samples[name] = float(value)
+        return samples
+
+class BasicGridfsFUSETestCase(MountTestCase):
 
     def test_read_write(self):
         with open(os.path.join(self.mount, 'testfile.txt'), 'w') as w:
@@ -113,6 +169,22 @@ class BasicGridfsFUSETestCase(unittest.TestCase):
         with open(path2, 'r') as r:
             self.assertEquals('file1', r.read())
 
+    def test_rename_over_newer_file(self):
+        path1 = os.path.join(self.mount, 'file1')
+        path2 = os.path.join(self.mount, 'file2')
+
+        with open(path1, 'w') as w:
+            w.write('older')
+        time.sleep(0.01)
+        with open(path2, 'w') as w:
+            w.write('newer')
+
+        os.rename(path1, path2)
+
+        self.assertEquals(['file2'], os.listdir(self.mount))
+        with open(path2, 'r') as r:
+            self.assertEquals('older', r.read())
+
     def test_big_file(self):
         # Test creation/reading of a file that's bigger than
         # the chunk size
@@ -146,6 +218,276 @@ class BasicGridfsFUSETestCase(unittest.TestCase):
 
         self.assertEquals(size2, os.stat(path).st_size)
 
+    def test_append(self):
+        path = os.path.join(self.mount, 'log')
+
+        with open(path, 'w') as w:
+            w.write('first\n')
+
+        with open(path, 'a') as a:
+            a.write('second\n')
+
+        with open(path, 'r') as r:
+            self.assertEquals('first\nsecond\n', r.read())
+
+        self.assertEquals(13, os.stat(path).st_size)
+
+    def test_append_across_chunks(self):
+        path = os.path.join(self.mount, 'big')
+        size = 256 * 1024 + 100
+        data1 = 'A' * size
+        data2 = 'B' * (256 * 1024 * 2)
+
+        with open(path, 'w') as w:
+            w.write(data1)
+
+        with open(path, 'a') as a:
+            a.write(data2)
+
+        with open(path, 'r') as r:
+            self.assertEquals(data1 + data2, r.read())
+
+        self.assertEquals(len(data1 + data2), os.stat(path).st_size)
+
+    def test_overwrite_middle_chunk(self):
+        path = os.path.join(self.mount, 'file')
+        chunk = 256 * 1024
+        data = 'A' * chunk + 'B' * chunk + 'C' * chunk
+
+        with open(path, 'w') as w:
+            w.write(data)
+
+        with open(path, 'r+') as f:
+            f.seek(chunk + 10)
+            f.write('x' * 20)
+
+        expected = data[:chunk + 10] + 'x' * 20 + data[chunk + 30:]
+        with open(path, 'r') as r:
+            self.assertEquals(expected, r.read())
+
+        self.assertEquals(len(data), os.stat(path).st_size)
+
+    def test_truncate_refused(self):
+        path = os.path.join(self.mount, 'file')
+        with open(path, 'w') as w:
+            w.write('keep')
+
+        try:
+            open(path, 'w')
+            self.fail('truncating an existing file succeeded')
+        except IOError, e:
+            self.assertEquals(errno.EACCES, e.errno)
+
+        with open(path, 'r') as r:
+            self.assertEquals('keep', r.read())
+
+    def test_xattrs(self):
+        path = os.path.join(self.mount, 'file')
+        with open(path, 'w') as w:
+            w.write('tagged')
+
+        self.assertEquals([], listxattr(path))
+
+        setxattr(path, 'user.tag', 'archived')
+        self.assertEquals('archived', getxattr(path, 'user.tag'))
+        self.assertEquals(['user.tag'], listxattr(path))
+
+        # Setting an xattr leaves the contents alone
+        with open(path, 'r') as r:
+            self.assertEquals('tagged', r.read())
+
+        removexattr(path, 'user.tag')
+        self.assertEquals([], listxattr(path))
+
+        try:
+            getxattr(path, 'user.tag')
+            self.fail('getxattr of a removed attribute succeeded')
+        except OSError, e:
+            self.assertEquals(errno.ENODATA, e.errno)
+
+    def test_xattr_flags(self):
+        path = os.path.join(self.mount, 'file')
+        with open(path, 'w') as w:
+            w.write('tagged')
+
+        def assert_fails(err, f, *args):
+            try:
+                f(*args)
+                self.fail('%s%r succeeded' % (f.__name__, args))
+            except OSError, e:
+                self.assertEquals(err, e.errno)
+
+        assert_fails(errno.ENODATA, setxattr, path, 'user.tag', 'new',
+                     XATTR_REPLACE)
+        setxattr(path, 'user.tag', 'first', XATTR_CREATE)
+        assert_fails(errno.EEXIST, setxattr, path, 'user.tag', 'second',
+                     XATTR_CREATE)
+        self.assertEquals('first', getxattr(path, 'user.tag'))
+
+        setxattr(path, 'user.tag', 'second', XATTR_REPLACE)
+        self.assertEquals('second', getxattr(path, 'user.tag'))
+
+        removexattr(path, 'user.tag')
+        assert_fails(errno.ENODATA, removexattr, path, 'user.tag')
+
+    def test_xattrs_while_appending(self):
+        path = os.path.join(self.mount, 'log')
+        with open(path, 'w') as w:
+            w.write('first\n')
+
+        with open(path, 'a') as a:
+            setxattr(path, 'user.tag', 'open')
+            self.assertEquals('open', getxattr(path, 'user.tag'))
+            self.assertEquals(['user.tag'], listxattr(path))
+            a.write('second\n')
+
+        # Flushing the append only sets its length and md5
+        self.assertEquals('open', getxattr(path, 'user.tag'))
+        with open(path, 'r') as r:
+            self.assertEquals('first\nsecond\n', r.read())
+
+    def test_stats(self):
+        path = os.path.join(self.mount, 'file')
+        with open(path, 'w') as w:
+            w.write('counted')
+
+        before = self.stats()
+        self.assert_('gridfs_read_bytes_total' in before)
+
+        with open(path, 'r') as r:
+            self.assertEquals('counted', r.read())
+
+        # Reading the stats file counts too
+        after = self.stats()
+        self.assert_(after['gridfs_read_bytes_total'] >=
+                     before['gridfs_read_bytes_total'] + len('counted'))
+
+    def test_nested_directories(self):
+        os.mkdir(os.path.join(self.mount, 'dir'))
+        os.mkdir(os.path.join(self.mount, 'dir', 'sub'))
+        for name in ['dir/a', 'dir/sub/b', 'dir/sub/c']:
+            with open(os.path.join(self.mount, name), 'w') as w:
+                w.write(name)
+
+        self.assert_(stat.S_ISDIR(os.stat(os.path.join(self.mount,
+                                                       'dir')).st_mode))
+        self.assertEquals(['dir'], os.listdir(self.mount))
+        self.assertEquals(['a', 'sub'],
+                          sorted(os.listdir(os.path.join(self.mount, 'dir'))))
+        self.assertEquals(['b', 'c'],
+                          sorted(os.listdir(os.path.join(self.mount,
+                                                         'dir', 'sub'))))
+
+        with open(os.path.join(self.mount, 'dir', 'sub', 'b'), 'r') as r:
+            self.assertEquals('dir/sub/b', r.read())
+
+    def test_empty_directory(self):
+        path = os.path.join(self.mount, 'empty')
+        os.mkdir(path)
+        self.assertEquals(['empty'], os.listdir(self.mount))
+        self.assertEquals([], os.listdir(path))
+
+        os.rmdir(path)
+        self.assertEquals([], os.listdir(self.mount))
+
+class LowlevelGridfsFUSETestCase(MountTestCase):
+    options = ['--lowlevel']
+
+    def test_ls(self):
+        os.mkdir(os.path.join(self.mount, 'dir'))
+        os.mkdir(os.path.join(self.mount, 'dir', 'sub'))
+        for name in ['file', 'dir/a', 'dir/sub/b']:
+            with open(os.path.join(self.mount, name), 'w') as w:
+                w.write(name)
+
+        self.assertEquals(['dir', 'file'], sorted(os.listdir(self.mount)))
+        self.assertEquals(['a', 'sub'],
+                          sorted(os.listdir(os.path.join(self.mount, 'dir'))))
+        with open(os.path.join(self.mount, 'dir/sub/b'), 'r') as r:
+            self.assertEquals('dir/sub/b', r.read())
+
+    def test_virtual_directory(self):
+        self.assertEquals(['stats'],
+                          os.listdir(os.path.join(self.mount, '.gridfs')))
+        self.assert_(stat.S_ISREG(
+            os.stat(os.path.join(self.mount, '.gridfs/stats')).st_mode))
+
+class ReadonlyGridfsFUSETestCase(MountTestCase):
+
+    # Stores the files read-write, then remounts read-only
+    def setUp(self):
+        MountTestCase.setUp(self)
+        os.mkdir(os.path.join(self.mount, 'dir'))
+        for name in ['file', 'dir/a']:
+            with open(os.path.join(self.mount, name), 'w') as w:
+                w.write(name)
+
+        self.unmount_gridfs()
+        self.mount_gridfs(['--readonly'])
+
+    def tearDown(self):
+        self.unmount_gridfs()
+        self.mount_gridfs(self.options)
+        MountTestCase.tearDown(self)
+
+    def test_read(self):
+        with open(os.path.join(self.mount, 'dir/a'), 'r') as r:
+            self.assertEquals('dir/a', r.read())
+        self.assertEquals(4, os.stat(os.path.join(self.mount, 'file')).st_size)
+
+    def test_ls(self):
+        self.assertEquals(['dir', 'file'], sorted(os.listdir(self.mount)))
+        self.assertEquals(['a'], os.listdir(os.path.join(self.mount, 'dir')))
+
+    def test_writes_refused(self):
+        def assert_fails(err, f, *args):
+            try:
+                f(*args)
+                self.fail('%s%r succeeded' % (f.__name__, args))
+            except EnvironmentError, e:
+                self.assertEquals(err, e.errno)
+
+        path = os.path.join(self.mount, 'file')
+        assert_fails(errno.EROFS, open, path, 'a')
+        assert_fails(errno.EROFS, open, os.path.join(self.mount, 'new'), 'w')
+        assert_fails(errno.EROFS, os.unlink, path)
+        assert_fails(errno.EROFS, os.rename, path,
+                     os.path.join(self.mount, 'moved'))
+
+        with open(path, 'r') as r:
+            self.assertEquals('file', r.read())
+
+class DiskCacheGridfsFUSETestCase(MountTestCase):
+
+    def setUp(self):
+        self.cache = tempfile.mkdtemp()
+        self.options = ['--disk_cache=%s' % self.cache]
+        MountTestCase.setUp(self)
+
+    def tearDown(self):
+        MountTestCase.tearDown(self)
+        shutil.rmtree(self.cache)
+
+    def test_survives_remount(self):
+        path = os.path.join(self.mount, 'big')
+        data = 'A' * (256 * 1024 * 2 + 100)
+        with open(path, 'w') as w:
+            w.write(data)
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+
+        self.unmount_gridfs()
+        self.mount_gridfs(self.options)
+
+        before = self.stats()
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+        after = self.stats()
+
+        self.assert_(after['gridfs_disk_cache_hits_total'] >
+                     before['gridfs_disk_cache_hits_total'])
+        self.assert_(os.listdir(self.cache))
+
 def suite():
     suite = unittest.TestSuite()
     suite.addTest(BasicGridfsFUSETestCase())
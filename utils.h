@@ -19,6 +19,7 @@
 #define __UTILS_H
 
 #include <ctime>
+#include <sys/time.h>
 #include <string>
 #include <cstring>
 
@@ -31,22 +32,14 @@ inline const char* fuse_to_mongo_path(const char* path)
   }
 }
 
-inline const bool is_leaf(const char* path) {
-  int pp = -1;
-  int sp = -1;
-  for(int i=0; i<strlen(path); i++) {
-    if(path[i] == '/') sp = i;
-    if(path[i] == '.') pp = i;
-  }
-  return pp > sp;
+inline std::string files_ns(const char* db)
+{
+  return std::string(db) + ".fs.files";
 }
 
-inline const int path_depth(const char* path) {
-  int sc = 0;
-  for(int i=0; i<strlen(path); i++) {
-    if(path[i] == '/') sc++;
-  }
-  return sc;
+inline std::string chunks_ns(const char* db)
+{
+  return std::string(db) + ".fs.chunks";
 }
 
 inline time_t mongo_time_to_unix_time(unsigned long long mtime)
@@ -64,6 +57,20 @@ inline time_t mongo_time()
   return unix_time_to_mongo_time(time(NULL));
 }
 
+// Seconds on a clock that doesn't jump, for expiring cache entries
+inline double monotonic_time()
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
 inline std::string namespace_xattr(const std::string name)
 {
 #ifdef __linux__
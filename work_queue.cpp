@@ -0,0 +1,80 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "work_queue.h"
+#include <iostream>
+
+#include <boost/bind.hpp>
+
+using namespace std;
+
+void WorkQueue::start(int threads)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _stopping = false;
+  for(int i = 0; i < threads; i++) {
+    _threads.create_thread(boost::bind(&WorkQueue::worker, this));
+  }
+}
+
+void WorkQueue::stop()
+{
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    _stopping = true;
+  }
+  _cond.notify_all();
+  _threads.join_all();
+}
+
+bool WorkQueue::push(const Job& job)
+{
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+    if(_stopping || !_threads.size() ||
+       (_maxPending && _jobs.size() >= _maxPending)) {
+      return false;
+    }
+    _jobs.push_back(job);
+  }
+  _cond.notify_one();
+  return true;
+}
+
+void WorkQueue::worker()
+{
+  while(true) {
+    Job job;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      while(_jobs.empty() && !_stopping) {
+        _cond.wait(lock);
+      }
+      if(_jobs.empty()) {
+        return;
+      }
+      job = _jobs.front();
+      _jobs.pop_front();
+    }
+
+    try {
+      job();
+    } catch(std::exception& e) {
+      cerr << "gridfs-fuse: background job failed: " << e.what() << endl;
+    }
+  }
+}
@@ -0,0 +1,57 @@
+/*
+ *  Copyright 2009 Michael Stephens
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WORK_QUEUE_H
+#define __WORK_QUEUE_H
+
+#include <deque>
+
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// Small fixed pool of background threads draining a FIFO of jobs.
+// Threads must be started from gridfs_init, after FUSE has daemonized.
+class WorkQueue {
+public:
+  typedef boost::function<void ()> Job;
+
+  WorkQueue(size_t maxPending = 0) :
+    _maxPending(maxPending), _stopping(false) {}
+  ~WorkQueue() { stop(); }
+
+  void start(int threads);
+  // Finishes any queued jobs and joins the threads
+  void stop();
+
+  // Returns false if the queue is full or not running and the job was
+  // dropped
+  bool push(const Job& job);
+
+private:
+  void worker();
+
+  size_t _maxPending;
+  bool _stopping;
+  std::deque<Job> _jobs;
+  boost::mutex _mutex;
+  boost::condition_variable _cond;
+  boost::thread_group _threads;
+};
+
+#endif